@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Description: Small write() latency benchmark
+ * Author: Ian Marco Moffett
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define BENCH_PATH  "/tmp/wbench"
+
+/* Writes per round, the file is rewound between rounds */
+#define BENCH_BATCH 64
+
+/* Number of rounds to time per buffer size */
+#define BENCH_ROUNDS 256
+
+static char data_buf[256];
+
+static inline uint64_t
+bench_cycles(void)
+{
+#if defined(__x86_64__)
+    uint32_t lo, hi;
+
+    __asm__ volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return 0;
+#endif  /* __x86_64__ */
+}
+
+/*
+ * Time small writes out of one buffer
+ *
+ * @fd: File to write to
+ * @buf: Buffer to write from
+ * @len: Bytes per write
+ * @name: Name to report the buffer as
+ */
+static void
+bench_write(int fd, const char *buf, size_t len, const char *name)
+{
+    uint64_t start, total = 0;
+    size_t nwrites = 0;
+
+    for (int i = 0; i < BENCH_ROUNDS; ++i) {
+        lseek(fd, 0, SEEK_SET);
+        start = bench_cycles();
+        for (int j = 0; j < BENCH_BATCH; ++j) {
+            if (write(fd, buf, len) < 0) {
+                printf("wbench: write failed\n");
+                return;
+            }
+        }
+
+        total += bench_cycles() - start;
+        nwrites += BENCH_BATCH;
+    }
+
+    printf(
+        "wbench: %s %d bytes: %d cycles/write\n",
+        name, (int)len,
+        (int)(total / nwrites)
+    );
+}
+
+int
+main(void)
+{
+    static const size_t sizes[] = { 1, 16, 64, 256 };
+    char stack_buf[256];
+    int fd;
+
+    fd = open(BENCH_PATH, O_CREAT | O_RDWR);
+    if (fd < 0) {
+        printf("wbench: could not open %s\n", BENCH_PATH);
+        return -1;
+    }
+
+    /*
+     * Use a stack buffer and a data buffer so that
+     * both the stack and the image ranges get checked.
+     */
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        bench_write(fd, stack_buf, sizes[i], "stack");
+        bench_write(fd, data_buf, sizes[i], "data");
+    }
+
+    close(fd);
+    return 0;
+}
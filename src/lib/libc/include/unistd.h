@@ -84,4 +84,13 @@ ssize_t read(int fd, void *buf, size_t count);
  */
 off_t lseek(int fd, off_t offset, int whence);
 
+/*
+ * Create a new process by duplicating the calling
+ * process
+ *
+ * Returns zero in the child, the PID of the child in
+ * the parent or a less than zero value on failure
+ */
+pid_t fork(void);
+
 #endif  /* _UNISTD_H */
@@ -43,3 +43,15 @@ mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
         off
     );
 }
+
+int
+munmap(void *addr, size_t len)
+{
+    return syscall(SYS_munmap, (uintptr_t)addr, len);
+}
+
+int
+mprotect(void *addr, size_t len, int prot)
+{
+    return syscall(SYS_mprotect, (uintptr_t)addr, len, prot);
+}
@@ -30,17 +30,31 @@
 #include <sys/bootvars.h>
 #include <sys/panic.h>
 #include <sys/syslog.h>
+#include <sys/errno.h>
 #include <acpi/acpi.h>
 #include <acpi/tables.h>
 #if defined(__x86_64__)
 #include <machine/hpet.h>
 #endif
 #include <vm/vm.h>
+#include <os/kalloc.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* Max number of tables we keep track of */
+#define ACPI_MAX_TABLES 64
 
 static size_t root_sdt_len = 0;
 static struct acpi_root_sdt *root_sdt = NULL;
 static uintptr_t rsdp_pa = 0;   /* [physical address] */
 
+/*
+ * Tables listed in the root SDT, these point into
+ * firmware memory until acpi_copy_tables() is called.
+ */
+static struct acpi_header *tabs[ACPI_MAX_TABLES];
+static bool tabs_copied = false;
+
 size_t
 acpi_get_root_sdt_len(void)
 {
@@ -53,6 +67,49 @@ acpi_get_root_sdt(void)
     return root_sdt;
 }
 
+struct acpi_header *
+acpi_get_table(size_t idx)
+{
+    if (idx >= root_sdt_len) {
+        return NULL;
+    }
+
+    return tabs[idx];
+}
+
+/*
+ * Copy every table we know of out of firmware memory
+ */
+int
+acpi_copy_tables(void)
+{
+    struct acpi_header *hdr, *copy;
+
+    if (tabs_copied) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < root_sdt_len; ++i) {
+        hdr = tabs[i];
+        if ((copy = kalloc(hdr->length)) == NULL) {
+            return -ENOMEM;
+        }
+
+        memcpy(copy, hdr, hdr->length);
+        tabs[i] = copy;
+    }
+
+    hdr = &root_sdt->hdr;
+    if ((copy = kalloc(hdr->length)) == NULL) {
+        return -ENOMEM;
+    }
+
+    memcpy(copy, hdr, hdr->length);
+    root_sdt = (struct acpi_root_sdt *)copy;
+    tabs_copied = true;
+    return 0;
+}
+
 /*
  * ACPI initialization
  */
@@ -61,6 +118,8 @@ acpi_early_init(void)
 {
     struct bootvars bootvars;
     struct acpi_rsdp *rsdp;
+    size_t entsize;
+    uint64_t pa;
     int error;
 
     error = bootvars_read(&bootvars, 0);
@@ -75,9 +134,11 @@ acpi_early_init(void)
     /* Fetch the root SDT */
     if (rsdp->revision >= 2) {
         root_sdt = PHYS_TO_VIRT(rsdp->xsdt_addr);
+        entsize = sizeof(uint64_t);
         printf("acpi: using XSDT as root SDT\n");
     } else {
         root_sdt = PHYS_TO_VIRT(rsdp->rsdt_addr);
+        entsize = sizeof(uint32_t);
         printf("acpi: using RSDT as root SDT\n");
     }
 
@@ -85,7 +146,19 @@ acpi_early_init(void)
         panic("root SDT checksum is invalid!\n");
     }
 
-    root_sdt_len = (root_sdt->hdr.length - sizeof(root_sdt->hdr)) / 4;
+    /* XSDT entries are 64-bits wide and may be unaligned */
+    root_sdt_len = (root_sdt->hdr.length - sizeof(root_sdt->hdr)) / entsize;
+    if (root_sdt_len > ACPI_MAX_TABLES) {
+        printf("acpi: only using %d tables\n", ACPI_MAX_TABLES);
+        root_sdt_len = ACPI_MAX_TABLES;
+    }
+
+    for (size_t i = 0; i < root_sdt_len; ++i) {
+        pa = 0;
+        memcpy(&pa, (char *)root_sdt->tables + (i * entsize), entsize);
+        tabs[i] = PHYS_TO_VIRT(pa);
+    }
+
 #if defined(__x86_64__)
     hpet_init();
 #endif
@@ -48,15 +48,13 @@ void *
 acpi_query(const char *query)
 {
     struct acpi_header *hdr;
-    struct acpi_root_sdt *root_sdt;
     size_t root_sdt_len, signature_len;
 
-    root_sdt = acpi_get_root_sdt();
     root_sdt_len = acpi_get_root_sdt_len();
     signature_len = sizeof(hdr->signature);
 
     for (size_t i = 0; i < root_sdt_len; ++i) {
-        hdr = (struct acpi_header *)PHYS_TO_VIRT(root_sdt->tables[i]);
+        hdr = acpi_get_table(i);
 
         if (memcmp(hdr->signature, query, signature_len) == 0) {
             return (void *)hdr;
@@ -73,16 +71,16 @@ int
 acpi_read_madt(uint32_t type, int(*cb)(struct apic_header *, size_t arg),
     size_t arg)
 {
-    static struct acpi_madt *madt = NULL;
+    struct acpi_madt *madt;
     uint8_t *cur, *end;
     int retval = -1;
     struct apic_header *apichdr;
 
-    /* Try to read the MADT table */
-    if (madt == NULL) {
-        madt = acpi_query("APIC");
-    }
-    if (madt == NULL) {
+    /*
+     * Not cached as the table moves once it is copied
+     * out of firmware memory.
+     */
+    if ((madt = acpi_query("APIC")) == NULL) {
         panic("ioapic_read_madt: failed to get MADT\n");
     }
 
@@ -35,6 +35,8 @@
 #include <machine/gdt.h>
 #include <machine/mdcpu.h>
 #include <machine/cpuid.h>
+#include <machine/fpu.h>
+#include <machine/tlb.h>
 #include <string.h>
 
 /* Valid vendor strings */
@@ -44,6 +46,7 @@
 
 extern void syscall_isr(void);
 extern void core_halt_isr(void);
+extern void tlb_shootdown_isr(void);
 
 void core_halt_handler(void);
 int simd_init(void);
@@ -68,6 +71,7 @@ init_vectors(void)
     idt_set_desc(0x4, IDT_TRAP_GATE, ISR(overflow), 0);
     idt_set_desc(0x5, IDT_TRAP_GATE, ISR(bound_range), 0);
     idt_set_desc(0x6, IDT_TRAP_GATE, ISR(invl_op), 0);
+    idt_set_desc(0x7, IDT_TRAP_GATE, ISR(dev_na), 0);
     idt_set_desc(0x8, IDT_TRAP_GATE, ISR(double_fault), 0);
     idt_set_desc(0xA, IDT_TRAP_GATE, ISR(invl_tss), 0);
     idt_set_desc(0xB, IDT_TRAP_GATE, ISR(segnp), 0);
@@ -76,6 +80,7 @@ init_vectors(void)
     idt_set_desc(0xE, IDT_TRAP_GATE, ISR(page_fault), 0);
     idt_set_desc(0x80, IDT_USER_GATE, ISR(syscall_isr), 0);
     idt_set_desc(HALT_VECTOR, IDT_USER_GATE, ISR(core_halt_isr), 0);
+    idt_set_desc(TLB_VECTOR, IDT_INT_GATE, ISR(tlb_shootdown_isr), 0);
 }
 
 /*
@@ -195,7 +200,8 @@ cpu_conf(struct pcore *pcore)
     pcore->self = pcore;
     wrmsr(IA32_GS_BASE, (uintptr_t)pcore);
 
-    simd_init();
+    fpu_init(simd_init());
+    mmu_pcid_init();
     init_vectors();
     idt_load();
     cpu_identify(mdcore);
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Description: Lazy FPU/SIMD state switching
+ * Author: Ian Marco Moffett
+ */
+
+#include <sys/types.h>
+#include <sys/cdefs.h>
+#include <sys/param.h>
+#include <sys/errno.h>
+#include <sys/syslog.h>
+#include <sys/cpuvar.h>
+#include <sys/proc.h>
+#include <vm/vm.h>
+#include <vm/physseg.h>
+#include <machine/fpu.h>
+#include <machine/pcb.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define CR0_TS          BIT(3)  /* Task switched */
+#define CR4_OSXSAVE     BIT(18) /* XSAVE enabled */
+
+#define FPU_NONE        0       /* No FPU switching at all */
+#define FPU_FXSAVE      1       /* Legacy 512 byte area */
+#define FPU_XSAVE       2       /* XSAVE area from leaf 0xD */
+
+/* Initial x87 control word and MXCSR, everything masked */
+#define FPU_FCW_INIT    0x037F
+#define FPU_MXCSR_INIT  0x1F80
+
+static int fpu_mode = FPU_NONE;
+static bool has_xsaveopt = false;
+static size_t fpu_size = 0;
+
+static inline uint64_t
+fpu_rcr0(void)
+{
+    uint64_t cr0;
+
+    __ASMV("mov %%cr0, %0" : "=r" (cr0));
+    return cr0;
+}
+
+static inline void
+fpu_clts(void)
+{
+    if (ISSET(fpu_rcr0(), CR0_TS)) {
+        __ASMV("clts");
+    }
+}
+
+static inline void
+fpu_stts(void)
+{
+    uint64_t cr0 = fpu_rcr0();
+
+    /* CR0 writes serialize, skip them when we can */
+    if (!ISSET(cr0, CR0_TS)) {
+        cr0 |= CR0_TS;
+        __ASMV("mov %0, %%cr0" :: "r" (cr0) : "memory");
+    }
+}
+
+/*
+ * CPUID with a subleaf, the CPUID() macro cannot
+ * select one.
+ */
+static inline void
+fpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *res)
+{
+    __ASMV(
+        "cpuid"
+        : "=a" (res[0]), "=b" (res[1]),
+          "=c" (res[2]), "=d" (res[3])
+        : "a" (leaf), "c" (subleaf)
+    );
+}
+
+/*
+ * Write the live FPU state out to an area, XSAVEOPT
+ * skips whatever has not changed since the area was
+ * last loaded on this core.
+ */
+static inline void
+fpu_store(void *area)
+{
+    switch (fpu_mode) {
+    case FPU_XSAVE:
+        if (has_xsaveopt) {
+            __ASMV(
+                "xsaveopt64 (%0)"
+                :: "r" (area), "a" (-1), "d" (-1)
+                : "memory"
+            );
+        } else {
+            __ASMV(
+                "xsave64 (%0)"
+                :: "r" (area), "a" (-1), "d" (-1)
+                : "memory"
+            );
+        }
+        break;
+    case FPU_FXSAVE:
+        __ASMV("fxsave64 (%0)" :: "r" (area) : "memory");
+        break;
+    }
+}
+
+/*
+ * Load the FPU state from an area
+ */
+static inline void
+fpu_restore(void *area)
+{
+    switch (fpu_mode) {
+    case FPU_XSAVE:
+        __ASMV(
+            "xrstor64 (%0)"
+            :: "r" (area), "a" (-1), "d" (-1)
+            : "memory"
+        );
+        break;
+    case FPU_FXSAVE:
+        __ASMV("fxrstor64 (%0)" :: "r" (area) : "memory");
+        break;
+    }
+}
+
+/*
+ * Allocate a save area for a process
+ *
+ * @pcbp: PCB to allocate an area for
+ * @init: If true, put it in the initial state
+ */
+static int
+fpu_alloc(struct md_pcb *pcbp, bool init)
+{
+    uintptr_t pa;
+    uint8_t *area;
+
+    pa = vm_alloc_frame_flags(
+        BYTES_TO_PAGES(fpu_size),
+        VM_ALLOC_NOZERO | VM_ALLOC_TRY
+    );
+    if (pa == 0) {
+        return -ENOMEM;
+    }
+
+    area = PHYS_TO_VIRT(pa);
+    if (init) {
+        /*
+         * A zeroed XSAVE header puts everything but MXCSR
+         * in its initial state on XRSTOR, FXRSTOR takes the
+         * legacy region as is.
+         */
+        memset(area, 0, fpu_size);
+        *(uint16_t *)&area[0] = FPU_FCW_INIT;
+        *(uint32_t *)&area[24] = FPU_MXCSR_INIT;
+    }
+
+    pcbp->fpu = area;
+    return 0;
+}
+
+int
+fpu_trap(void)
+{
+    struct pcore *core = this_core();
+    struct md_pcb *pcbp;
+    struct proc *self;
+    int error;
+
+    if (fpu_mode == FPU_NONE || core == NULL) {
+        return -ENOTSUP;
+    }
+
+    /* The kernel itself never touches the FPU */
+    self = core->curproc;
+    if (self == NULL || ISSET(self->flags, PROC_KTD)) {
+        return -EPERM;
+    }
+
+    pcbp = &self->pcb;
+    if (pcbp->fpu == NULL) {
+        if ((error = fpu_alloc(pcbp, true)) < 0) {
+            printf("fpu_trap: could not allocate save area\n");
+            return error;
+        }
+    }
+
+    /*
+     * Whoever had the FPU before was saved when it was
+     * switched away from, just load over it.
+     */
+    fpu_clts();
+    fpu_restore(pcbp->fpu);
+    core->md.fpu_owner = self;
+    pcbp->fpu_core = core;
+    return 0;
+}
+
+void
+fpu_save(struct pcore *core, struct proc *proc)
+{
+    struct md_pcb *pcbp;
+
+    if (fpu_mode == FPU_NONE || core == NULL || proc == NULL) {
+        return;
+    }
+
+    /*
+     * Only save what is live here, if CR0.TS is set then
+     * nothing was touched since the last switch.
+     */
+    pcbp = &proc->pcb;
+    if (core->md.fpu_owner != proc || pcbp->fpu_core != core) {
+        return;
+    }
+    if (pcbp->fpu == NULL || ISSET(fpu_rcr0(), CR0_TS)) {
+        return;
+    }
+
+    fpu_store(pcbp->fpu);
+}
+
+void
+fpu_load(struct pcore *core, struct proc *proc)
+{
+    struct md_pcb *pcbp;
+
+    if (fpu_mode == FPU_NONE || core == NULL) {
+        return;
+    }
+
+    /*
+     * If nobody else loaded their state here since this
+     * process last ran, the registers are still good and
+     * there is no need to trap.
+     */
+    if (proc != NULL && core->md.fpu_owner == proc) {
+        pcbp = &proc->pcb;
+        if (pcbp->fpu_core == core) {
+            fpu_clts();
+            return;
+        }
+    }
+
+    fpu_stts();
+}
+
+int
+fpu_fork(struct proc *child, struct proc *parent)
+{
+    struct md_pcb *ppcb, *cpcb;
+    int error;
+
+    if (child == NULL || parent == NULL) {
+        return -EINVAL;
+    }
+
+    /* Nothing to copy if the parent never used it */
+    ppcb = &parent->pcb;
+    cpcb = &child->pcb;
+    if (fpu_mode == FPU_NONE || ppcb->fpu == NULL) {
+        return 0;
+    }
+
+    fpu_save(this_core(), parent);
+    if ((error = fpu_alloc(cpcb, false)) < 0) {
+        return error;
+    }
+
+    memcpy(cpcb->fpu, ppcb->fpu, fpu_size);
+    return 0;
+}
+
+void
+fpu_free(struct proc *proc)
+{
+    struct md_pcb *pcbp;
+
+    if (proc == NULL) {
+        return;
+    }
+
+    pcbp = &proc->pcb;
+    if (pcbp->fpu != NULL) {
+        vm_free_frame(VIRT_TO_PHYS(pcbp->fpu), BYTES_TO_PAGES(fpu_size));
+        pcbp->fpu = NULL;
+    }
+
+    pcbp->fpu_core = NULL;
+}
+
+void
+fpu_init(int simd)
+{
+    struct pcore *core = this_core();
+    uint32_t res[4];
+    uint64_t cr4;
+
+    if (simd == SIMD_NONE) {
+        fpu_mode = FPU_NONE;
+        return;
+    }
+
+    /*
+     * simd_init() turns on OSXSAVE if it could, the XSAVE
+     * area size depends on what it put in XCR0. Every core
+     * comes up the same way so this is the same everywhere.
+     */
+    __ASMV("mov %%cr4, %0" : "=r" (cr4));
+    if (ISSET(cr4, CR4_OSXSAVE)) {
+        fpu_cpuid(0xD, 0, res);
+        fpu_size = res[1];
+        fpu_cpuid(0xD, 1, res);
+        has_xsaveopt = ISSET(res[0], BIT(0));
+        fpu_mode = FPU_XSAVE;
+    } else {
+        fpu_size = 512;
+        fpu_mode = FPU_FXSAVE;
+    }
+
+    if (core != NULL) {
+        core->md.fpu_owner = NULL;
+    }
+
+    fpu_clts();
+}
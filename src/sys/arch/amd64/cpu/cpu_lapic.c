@@ -321,6 +321,21 @@ lapic_timer_oneshot_us(size_t usec)
     lapic_timer_oneshot(false, ticks);
 }
 
+/*
+ * Stop the Local APIC timer of the current core
+ */
+void
+lapic_timer_halt(void)
+{
+    struct pcore *core;
+
+    if ((core = this_core()) == NULL) {
+        return;
+    }
+
+    lapic_timer_stop(&core->md);
+}
+
 /*
  * Send an end-of-interrupt to the current
  * core's Local APIC
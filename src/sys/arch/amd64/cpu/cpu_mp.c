@@ -36,6 +36,7 @@
 #include <sys/limits.h>
 #include <os/kalloc.h>
 #include <os/spinlock.h>
+#include <vm/physseg.h>
 #include <machine/mdcpu.h>
 #include <string.h>
 #include <limine.h>
@@ -60,7 +61,13 @@ static void
 cpu_idle(void *)
 {
     for (;;) {
-        __ASMV("pause");
+        /* Zero frames ahead of time while we are idle */
+        if (vm_zero_idle() == 0) {
+            continue;
+        }
+
+        /* Nothing to do, sleep until someone needs us */
+        __ASMV("hlt");
     }
 }
 
@@ -68,7 +75,6 @@ __dead static void
 ap_entry(struct limine_smp_info *)
 {
     struct pcore *pcore;
-    struct proc *curidle;
 
     spinlock_acquire(&lock);
     pcore = kalloc(sizeof(*pcore));
@@ -78,14 +84,15 @@ ap_entry(struct limine_smp_info *)
 
     /* Initialize the core */
     memset(pcore, 0, sizeof(*pcore));
-    TAILQ_INIT(&pcore->scq.q);
+    sched_queue_init(&pcore->scq, pcore);
+    callout_wheel_init(&pcore->wheel);
     pcore->id = ncores_up;
     cpu_conf(pcore);
     cpu_init(pcore);
 
     corelist[ncores_up - 1] = pcore;
     atomic_inc_64(&ncores_up);
-    proc_ktd(&curidle, cpu_idle);
+    proc_idle_td(pcore, cpu_idle);
     spinlock_release(&lock);
 
     md_proc_idle();
@@ -93,6 +100,18 @@ ap_entry(struct limine_smp_info *)
     for (;;);
 }
 
+/*
+ * Cores we do not start would otherwise keep spinning
+ * in bootloader memory that we reclaim later on.
+ */
+__dead static void
+ap_park(struct limine_smp_info *)
+{
+    for (;;) {
+        __ASMV("cli; hlt");
+    }
+}
+
 /*
  * Get a specific core descriptor
  */
@@ -110,13 +129,21 @@ cpu_get(uint16_t index)
     return corelist[index - 1];
 }
 
+/*
+ * Get the number of cores online
+ */
+size_t
+cpu_count(void)
+{
+    return atomic_load_64(&ncores_up);
+}
+
 void
 bsp_ap_startup(void)
 {
     struct limine_smp_response *resp = g_smp_req.response;
     struct limine_smp_info **cpus;
     struct mdcore *mdcore;
-    struct proc *curidle;
     uint32_t ncores, tmp;
 
     /* Sanity check */
@@ -141,6 +168,9 @@ bsp_ap_startup(void)
         printf("mp: not starting %d cores\n", tmp);
     }
 
+    /* Even a single core needs something to fall back on */
+    proc_idle_td(&g_bsp, cpu_idle);
+
     /* Don't continue if we have only one core */
     if (ncores == 1) {
         printf("mp: single cored CPU - no APs to bring up\n");
@@ -149,8 +179,6 @@ bsp_ap_startup(void)
 
     printf("mp: bringing APs online...\n");
     mdcore = &g_bsp.md;
-
-    proc_ktd(&curidle, cpu_idle);
     for (int i = 0; i < ncores; ++i) {
         if (mdcore->apic_id == cpus[i]->lapic_id) {
             continue;
@@ -159,6 +187,11 @@ bsp_ap_startup(void)
         cpus[i]->goto_address = ap_entry;
     }
 
+    for (int i = ncores; i < resp->cpu_count; ++i) {
+        if (mdcore->apic_id != cpus[i]->lapic_id)
+            cpus[i]->goto_address = ap_park;
+    }
+
     while (ncores_up < ncores);
     printf("mp: %d cores [up]\n", ncores - 1);
 }
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Description: TLB shootdown IPIs
+ * Author: Ian Marco Moffett
+ */
+
+#include <sys/types.h>
+#include <sys/cdefs.h>
+#include <sys/param.h>
+#include <sys/atomic.h>
+#include <sys/limits.h>
+#include <sys/cpuvar.h>
+#include <os/spinlock.h>
+#include <machine/mdcpu.h>
+#include <machine/lapic.h>
+#include <machine/tlb.h>
+#include <stdbool.h>
+
+void tlb_shootdown_handler(void);
+
+/*
+ * Queue invalidations on another core
+ *
+ * @q: Queue of the target core
+ * @va: Page bases to invalidate
+ * @count: Number of pages in `va'
+ * @all: If true, flush the whole TLB instead
+ *
+ * Returns true if the core has to be interrupted, false
+ * if an earlier request it has yet to handle will pick
+ * these up as well.
+ */
+static bool
+tlb_queue_push(struct tlb_queue *q, const vaddr_t *va, size_t count, bool all)
+{
+    bool idle;
+
+    spinlock_acquire(&q->lock);
+    idle = (q->req == q->done);
+
+    /* Degrade to a full flush if we run out of room */
+    if (all || (q->count + count) > TLB_QUEUE_MAX) {
+        q->all = true;
+        q->count = 0;
+    }
+
+    if (!q->all) {
+        for (size_t i = 0; i < count; ++i)
+            q->va[q->count++] = va[i];
+    }
+
+    ++q->req;
+    spinlock_release(&q->lock);
+    return idle;
+}
+
+void
+tlb_drain(void)
+{
+    struct pcore *core = this_core();
+    struct tlb_queue *q;
+    uint64_t state;
+
+    if (core == NULL) {
+        return;
+    }
+
+    /* Nothing pending? */
+    q = &core->md.tlbq;
+    if (atomic_load_64(&q->req) == atomic_load_64(&q->done)) {
+        return;
+    }
+
+    state = md_intr_save();
+    spinlock_acquire(&q->lock);
+    if (q->all || q->count > 0) {
+        mmu_flush_local(q->va, q->count, q->all);
+    }
+
+    q->count = 0;
+    q->all = false;
+    atomic_store_64(&q->done, q->req);
+    spinlock_release(&q->lock);
+    md_intr_restore(state);
+}
+
+/*
+ * Called from the TLB_VECTOR interrupt stub
+ */
+void
+tlb_shootdown_handler(void)
+{
+    tlb_drain();
+    lapic_eoi();
+}
+
+void
+tlb_shootdown(paddr_t cr3, const vaddr_t *va, size_t count, bool all)
+{
+    uint64_t targets[CPU_MAX / 64] = {0};
+    struct pcore *self, *core;
+    struct tlb_queue *q;
+    uint64_t state, want;
+    size_t ncores;
+    struct lapic_ipi ipi = {
+        .shorthand = IPI_SHAND_NONE,
+        .delmod = IPI_DELMOD_FIXED,
+        .vector = TLB_VECTOR,
+        .apic_id = 0,
+        .dest_mode = IPI_DESTMODE_PHYSICAL
+    };
+
+    if ((ncores = cpu_count()) <= 1) {
+        return;
+    }
+
+    state = md_intr_save();
+    if ((self = this_core()) == NULL) {
+        md_intr_restore(state);
+        return;
+    }
+
+    for (size_t i = 0; i < ncores; ++i) {
+        if ((core = cpu_get(i)) == NULL || core == self) {
+            continue;
+        }
+
+        /*
+         * Cores on other address spaces are left alone,
+         * the VAS was retagged before we got here so they
+         * will flush when they switch back to it.
+         */
+        if (cr3 != 0 && atomic_load_64(&core->md.cr3) != cr3) {
+            continue;
+        }
+
+        targets[i / 64] |= BIT(i % 64);
+        if (tlb_queue_push(&core->md.tlbq, va, count, all)) {
+            ipi.apic_id = core->md.apic_id;
+            lapic_tx_ipi(&ipi);
+        }
+    }
+
+    /* Wait for each target to catch up */
+    for (size_t i = 0; i < ncores; ++i) {
+        if (!ISSET(targets[i / 64], BIT(i % 64))) {
+            continue;
+        }
+
+        q = &cpu_get(i)->md.tlbq;
+        want = atomic_load_64(&q->req);
+        while (atomic_load_64(&q->done) < want) {
+            /* Someone may be waiting on us too */
+            tlb_drain();
+            md_spinwait();
+        }
+    }
+
+    md_intr_restore(state);
+}
@@ -37,9 +37,13 @@
 #include <sys/param.h>
 #include <sys/cdefs.h>
 #include <sys/panic.h>
+#include <sys/atomic.h>
+#include <sys/syslog.h>
 #include <vm/mmu.h>
 #include <vm/vm.h>
 #include <vm/physseg.h>
+#include <machine/cpuid.h>
+#include <machine/tlb.h>
 #include <string.h>
 #include <stdbool.h>
 
@@ -60,12 +64,47 @@
 #define PTE_GLOBAL      BIT(8)        /* Global / sticky map */
 #define PTE_NX          BIT(63)       /* Execute-disable */
 
+/* Start of the higher half */
+#define KERNEL_BASE_MIN 0xFFFF800000000000
+
+/* Sizes of huge pages */
+#define PGSIZE_2M       0x200000
+#define PGSIZE_1G       0x40000000
+
 /*
  * Used to enable/disable 57-bit paging which expands
  * the paging levels to MMU_L5
  */
 #define CR4_L5_PAGING  BIT(12)
 
+/* Enables global pages */
+#define CR4_PGE        BIT(7)
+
+/* Enables process-context identifiers */
+#define CR4_PCIDE      BIT(17)
+
+/* CR3 PCID field and "don't flush" bit */
+#define CR3_PCID_MASK  0xFFF
+#define CR3_NOFLUSH    BIT(63)
+
+/* INVPCID types */
+#define INVPCID_CTX    1    /* Single context */
+#define INVPCID_ALL    2    /* All contexts, including globals */
+
+/*
+ * Max number of pages to invalidate one by one
+ * after a range operation, anything past this
+ * flushes the whole TLB instead.
+ */
+#define MMU_FLUSH_MAX  32
+
+/*
+ * Max number of page tables a batch may hold on to
+ * until the TLB is flushed, the batch is committed
+ * early once this many are queued.
+ */
+#define MMU_FREE_MAX   16
+
 /*
  * Describes each paging level
  *
@@ -82,6 +121,60 @@ typedef enum {
     MMU_L5
 } pglvl_t;
 
+/* Set if the processor supports 1 GiB pages */
+static bool has_1g = false;
+
+/* Paging level, cached by mmu_init() */
+static pglvl_t pg_level = MMU_OFF;
+
+/* PCID / INVPCID support */
+static bool has_pcid = false;
+static bool has_invpcid = false;
+static volatile unsigned long next_tag = 0;
+
+/* From kconf */
+#if defined(__PCID_BENCH)
+#define PCID_BENCH __PCID_BENCH
+#else
+#define PCID_BENCH 0
+#endif
+
+/*
+ * A page table that was unlinked but may still be
+ * walked by other cores until the TLB is flushed.
+ *
+ * @pa: Physical address of the table
+ * @lvl: Level of the table
+ */
+struct mmu_dead_tbl {
+    paddr_t pa;
+    pglvl_t lvl;
+};
+
+/*
+ * Pages that need to be invalidated after a range
+ * operation.
+ *
+ * @va: Page bases to invalidate
+ * @count: Number of pages in `va'
+ * @all: Flush the whole TLB instead
+ * @stale: Translations were taken away or changed
+ * @kern: Pages in the higher half were touched
+ * @dead: Tables to free once the TLB is flushed
+ * @ndead: Number of entries in `dead'
+ */
+struct mmu_inval {
+    vaddr_t va[MMU_FLUSH_MAX];
+    size_t count;
+    bool all;
+    bool stale;
+    bool kern;
+    struct mmu_dead_tbl dead[MMU_FREE_MAX];
+    size_t ndead;
+};
+
+static void mmu_free_table(paddr_t tbl_pa, pglvl_t lvl);
+
 /*
  * Convert machine independent protection flags
  * to machine dependent flags.
@@ -162,12 +255,8 @@ __mmu_write_cr3(uint64_t val)
     );
 }
 
-/*
- * Acquire the paging level used by the
- * current processing element (pcore)
- */
-static inline pglvl_t
-mmu_pg_level(void)
+static inline uint64_t
+__mmu_read_cr4(void)
 {
     uint64_t cr4;
 
@@ -178,6 +267,199 @@ mmu_pg_level(void)
         : "memory"
     );
 
+    return cr4;
+}
+
+static inline void
+__mmu_write_cr4(uint64_t val)
+{
+    __ASMV(
+        "mov %0, %%cr4"
+        :
+        : "r" (val)
+        : "memory"
+    );
+}
+
+/*
+ * Invalidate TLB entries by PCID
+ *
+ * @type: Invalidation type (INVPCID_*)
+ * @pcid: PCID to target
+ * @va: Virtual address to target
+ */
+static inline void
+__invpcid(uint64_t type, uint16_t pcid, vaddr_t va)
+{
+    struct {
+        uint64_t pcid;
+        uint64_t va;
+    } desc = { pcid, va };
+
+    __ASMV(
+        "invpcid %0, %1"
+        :
+        : "m" (desc), "r" (type)
+        : "memory"
+    );
+}
+
+/*
+ * Flush the entire TLB, including global
+ * entries.
+ */
+static inline void
+__mmu_flush_all(void)
+{
+    uint64_t cr4 = __mmu_read_cr4();
+
+    if (has_invpcid) {
+        __invpcid(INVPCID_ALL, 0, 0);
+        return;
+    }
+
+    if (ISSET(cr4, CR4_PGE)) {
+        __mmu_write_cr4(cr4 & ~CR4_PGE);
+        __mmu_write_cr4(cr4);
+        return;
+    }
+
+    __mmu_write_cr3(__mmu_read_cr3());
+}
+
+/*
+ * Queue a page to be invalidated
+ *
+ * @ip: Invalidation batch
+ * @va: Page base to invalidate
+ */
+static inline void
+mmu_inval_add(struct mmu_inval *ip, vaddr_t va)
+{
+    if (va >= KERNEL_BASE_MIN) {
+        ip->kern = true;
+    }
+
+    if (ip->all) {
+        return;
+    }
+
+    if (ip->count >= MMU_FLUSH_MAX) {
+        ip->all = true;
+        return;
+    }
+
+    ip->va[ip->count++] = va;
+}
+
+/*
+ * Give an address space a new tag after some of its
+ * translations were taken away. Any PCID still tagged
+ * with the old one will miss and be flushed before it
+ * is used again.
+ *
+ * @vas: Address space to retag
+ */
+static void
+mmu_vas_retag(struct vm_vas *vas)
+{
+    struct pcore *core = this_core();
+    uint64_t old = vas->tag;
+    uint64_t *slot;
+    uint8_t pcid;
+
+    if (old == 0) {
+        return;
+    }
+
+    /*
+     * This store must be visible before tlb_shootdown()
+     * looks at which cores are on this address space,
+     * see mmu_write_vas().
+     */
+    atomic_store_64(&vas->tag, atomic_inc_long(&next_tag));
+    if (core == NULL || (pcid = vas->pcid[core->id]) >= MMU_NPCID) {
+        return;
+    }
+
+    /*
+     * If we are running on this address space, its
+     * PCID was just invalidated so it stays ours.
+     */
+    slot = &core->md.pcid_tag[pcid];
+    if (*slot == old && (__mmu_read_cr3() & PTE_ADDR_MASK) == vas->cr3) {
+        *slot = vas->tag;
+    }
+}
+
+void
+mmu_flush_local(const vaddr_t *va, size_t count, bool all)
+{
+    if (all) {
+        __mmu_flush_all();
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        __invlpg((void *)va[i]);
+    }
+}
+
+/*
+ * Invalidate every page in a batch, if translations
+ * were taken away then other cores running on the
+ * same address space are told to drop them too.
+ *
+ * @vas: Address space the batch belongs to
+ * @ip: Invalidation batch
+ */
+static void
+mmu_inval_commit(struct vm_vas *vas, struct mmu_inval *ip)
+{
+    /*
+     * The higher half is shared by every address space
+     * so entries cached under other PCIDs must go too.
+     */
+    if (ip->stale && ip->kern) {
+        ip->all = true;
+    }
+
+    mmu_flush_local(ip->va, ip->count, ip->all);
+    if (ip->stale) {
+        mmu_vas_retag(vas);
+        tlb_shootdown(
+            ip->kern ? 0 : vas->cr3,
+            ip->va, ip->count,
+            ip->all
+        );
+    }
+
+    /* Nobody can walk into these anymore */
+    for (size_t i = 0; i < ip->ndead; ++i) {
+        mmu_free_table(ip->dead[i].pa, ip->dead[i].lvl);
+    }
+
+    ip->count = 0;
+    ip->all = false;
+    ip->stale = false;
+    ip->kern = false;
+    ip->ndead = 0;
+}
+
+/*
+ * Acquire the paging level used by the
+ * current processing element (pcore)
+ */
+static inline pglvl_t
+mmu_pg_level(void)
+{
+    uint64_t cr4;
+
+    if (pg_level != MMU_OFF) {
+        return pg_level;
+    }
+
+    cr4 = __mmu_read_cr4();
     if (ISSET(cr4, CR4_L5_PAGING)) {
         return MMU_L5;
     }
@@ -214,6 +496,105 @@ mmu_get_level(vaddr_t vaddr, pglvl_t level)
     __builtin_unreachable();
 }
 
+/*
+ * Get the number of bytes mapped by a single
+ * entry at a specific level.
+ *
+ * @lvl: Level of the entry
+ */
+static inline size_t
+mmu_level_pgsize(pglvl_t lvl)
+{
+    switch (lvl) {
+    case MMU_L3:
+        return PGSIZE_1G;
+    case MMU_L2:
+        return PGSIZE_2M;
+    default:
+        return DEFAULT_PAGESIZE;
+    }
+}
+
+/*
+ * Get the level at which pages of a specific
+ * size are mapped.
+ *
+ * @pgsize: Page size
+ *
+ * Returns MMU_OFF if the page size is not supported
+ */
+static inline pglvl_t
+mmu_pgsize_level(size_t pgsize)
+{
+    switch (pgsize) {
+    case DEFAULT_PAGESIZE:
+        return MMU_TBL;
+    case PGSIZE_2M:
+        return MMU_L2;
+    case PGSIZE_1G:
+        return has_1g ? MMU_L3 : MMU_OFF;
+    }
+
+    return MMU_OFF;
+}
+
+/*
+ * Free a page table along with every table below
+ * it, the frames being mapped are left alone.
+ *
+ * @tbl_pa: Physical address of the table
+ * @lvl: Level of the table
+ */
+static void
+mmu_free_table(paddr_t tbl_pa, pglvl_t lvl)
+{
+    uintptr_t *tbl = PHYS_TO_VIRT(tbl_pa);
+    uintptr_t ent;
+
+    for (int i = 0; i < 512 && lvl > MMU_TBL; ++i) {
+        ent = tbl[i];
+        if (!ISSET(ent, PTE_P) || ISSET(ent, PTE_PS)) {
+            continue;
+        }
+
+        mmu_free_table(ent & PTE_ADDR_MASK, lvl - 1);
+    }
+
+    vm_free_frame(tbl_pa, 1);
+}
+
+/*
+ * Split a huge page into a table of smaller pages
+ * that map the exact same range.
+ *
+ * @ent: Entry of the huge page
+ * @lvl: Level of the table the entry lives in
+ */
+static void
+mmu_split_huge(uintptr_t *ent, pglvl_t lvl)
+{
+    const size_t CHILD_SIZE = mmu_level_pgsize(lvl - 1);
+    uintptr_t *tbl, flags;
+    paddr_t pa, frame;
+
+    pa = *ent & PTE_ADDR_MASK;
+    pa = ALIGN_DOWN(pa, mmu_level_pgsize(lvl));
+    flags = *ent & ~PTE_ADDR_MASK;
+
+    /* PTE_PS is the PAT bit at the bottom level */
+    if ((lvl - 1) == MMU_TBL) {
+        flags &= ~PTE_PS;
+    }
+
+    frame = vm_alloc_frame_flags(1, VM_ALLOC_NOZERO);
+    tbl = PHYS_TO_VIRT(frame);
+    for (int i = 0; i < 512; ++i) {
+        tbl[i] = (pa + (i * CHILD_SIZE)) | flags;
+    }
+
+    *ent = frame | PTE_P | PTE_RW | PTE_US;
+}
+
 /*
  * Get the table at the desired level
  *
@@ -223,6 +604,8 @@ mmu_get_level(vaddr_t vaddr, pglvl_t level)
  * @res: Virtual address result is written here
  * @a: If true, allocate memory for unmapped entries
  *
+ * XXX: Huge pages in the way are always split
+ *
  * Returns zero on success, otherwise a less than
  * zero value on failure.
  */
@@ -254,6 +637,12 @@ mmu_read_level(struct vm_vas *vas, vaddr_t va, pglvl_t lvl, vaddr_t **res, bool
 
         /* Is this present? */
         if (ISSET(addr, PTE_P)) {
+            /* Huge pages are split on the way down */
+            if (ISSET(addr, PTE_PS)) {
+                mmu_split_huge(&cur[index], cur_level);
+                __invlpg((void *)va);
+            }
+
             addr = cur[index] & PTE_ADDR_MASK;
             cur = PHYS_TO_VIRT(addr);
             --cur_level;
@@ -298,38 +687,57 @@ mmu_this_vas(struct vm_vas *vasres_p)
         return -EINVAL;
     }
 
-    vasres_p->cr3 = __mmu_read_cr3();
+    vasres_p->cr3 = __mmu_read_cr3() & PTE_ADDR_MASK;
+    vasres_p->tag = 0;
+    memset(vasres_p->pcid, 0, sizeof(vasres_p->pcid));
     return 0;
 }
 
 /*
- * Create a virtual to physical mapping
+ * Install a single page table entry at the level of
+ * a specific page size.
+ *
+ * @vas: Virtual address space
+ * @spec: Mapping specifier
+ * @lvl: Level to install the entry at
+ * @prot: Protection flags (zero to unmap)
+ * @ip: Invalidation batch to add the page to
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
  */
-int
-mmu_map_single(struct vm_vas *vas, struct mmu_map *spec, int prot)
+static int
+__mmu_map_page(struct vm_vas *vas, struct mmu_map *spec, pglvl_t lvl, int prot,
+    struct mmu_inval *ip)
 {
     int error;
     size_t index;
     uint64_t pte_flags;
-    vaddr_t *pte;
-
-    if (spec == NULL) {
-        return -EINVAL;
-    }
+    uintptr_t old;
+    vaddr_t *tbl;
 
     /*
      * First things first, we need to translate these
      * architecture abstracting protection flags to
      * something these Intel MMUs will understand. We
-     * just need to start at the PML4, hit the bottom
-     * and plop em there.
+     * just need to start at the PML4, hit the level of
+     * the page size and plop em there.
      */
     pte_flags = prot_to_pte(prot);
+    if (lvl > MMU_TBL) {
+        pte_flags |= PTE_PS;
+    }
+
+    /* No need to create tables just to unmap */
     error = mmu_read_level(
-        vas, spec->va, MMU_TBL,
-        &pte, true
+        vas, spec->va, lvl,
+        &tbl, prot != 0
     );
 
+    if (error == -EPIPE && prot == 0) {
+        return 0;
+    }
+
     /* Did this fail? */
     if (error < 0) {
         return error;
@@ -338,15 +746,300 @@ mmu_map_single(struct vm_vas *vas, struct mmu_map *spec, int prot)
     /*
      * Now using the virtual address within the map spec,
      * we'll acquire the index at which we put the physical
-     * address, along with its flags. Then of course, flush the
-     * TLB entry.
+     * address, along with its flags. Then of course, queue
+     * the TLB entry to be flushed.
      */
-    index = mmu_get_level(spec->va, MMU_TBL);
-    pte[index] = (prot == 0) ? 0 : (pte_flags | spec->pa);
-    __invlpg((void *)spec->va);
+    index = mmu_get_level(spec->va, lvl);
+    old = tbl[index];
+    tbl[index] = (prot == 0) ? 0 : (pte_flags | spec->pa);
+    mmu_inval_add(ip, spec->va);
+    if (ISSET(old, PTE_P)) {
+        ip->stale = true;
+    }
+
+    /*
+     * If a huge page took the place of a page table, the
+     * table is no longer needed. The TLB may still hold
+     * any of the smaller pages within it so flush it all.
+     * Other cores may still walk the table through their
+     * paging-structure caches, so it is only freed after
+     * the batch has been committed.
+     */
+    if (lvl > MMU_TBL && ISSET(old, PTE_P) && !ISSET(old, PTE_PS)) {
+        ip->all = true;
+        ip->dead[ip->ndead].pa = old & PTE_ADDR_MASK;
+        ip->dead[ip->ndead].lvl = lvl - 1;
+        if (++ip->ndead >= MMU_FREE_MAX) {
+            mmu_inval_commit(vas, ip);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Map or unmap a range of pages, the leaf table is
+ * only looked up once for every run of pages within
+ * it and the TLB is invalidated once at the end.
+ *
+ * @vas: Virtual address space
+ * @va: Virtual base (4K aligned)
+ * @pa: Physical base (4K aligned, ignored if unmapping)
+ * @len: Length in bytes (4K aligned)
+ * @prot: Protection flags (zero to unmap)
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+static int
+__mmu_map_range(struct vm_vas *vas, vaddr_t va, paddr_t pa, size_t len, int prot)
+{
+    struct mmu_inval inval = {0};
+    struct mmu_map spec;
+    uint64_t pte_flags = prot_to_pte(prot);
+    vaddr_t start = va, end = va + len;
+    uintptr_t *tbl;
+    size_t pgsize, idx;
+    int error = 0;
+
+    if (prot == 0) {
+        pa = 0;
+    }
+
+    while (va < end) {
+        /* Use the largest pages we can */
+        pgsize = mmu_pgsize_fit(va, pa, end - va);
+        if (pgsize != DEFAULT_PAGESIZE) {
+            spec.va = va;
+            spec.pa = pa;
+            error = __mmu_map_page(
+                vas, &spec,
+                mmu_pgsize_level(pgsize),
+                prot, &inval
+            );
+
+            if (error < 0) {
+                break;
+            }
+
+            va += pgsize;
+            pa += (prot == 0) ? 0 : pgsize;
+            continue;
+        }
+
+        /* Grab the leaf table once for this run */
+        error = mmu_read_level(vas, va, MMU_TBL, &tbl, prot != 0);
+        if (error == -EPIPE && prot == 0) {
+            /* Nothing mapped here, skip the whole table */
+            va = ALIGN_DOWN(va, PGSIZE_2M) + PGSIZE_2M;
+            error = 0;
+            continue;
+        }
+
+        if (error < 0) {
+            break;
+        }
+
+        idx = mmu_get_level(va, MMU_TBL);
+        for (; idx < 512 && va < end; ++idx) {
+            if (ISSET(tbl[idx], PTE_P))
+                inval.stale = true;
+
+            tbl[idx] = (prot == 0) ? 0 : (pte_flags | pa);
+            mmu_inval_add(&inval, va);
+            va += DEFAULT_PAGESIZE;
+            pa += (prot == 0) ? 0 : DEFAULT_PAGESIZE;
+        }
+    }
+
+    mmu_inval_commit(vas, &inval);
+
+    /* Don't leave a partial mapping behind */
+    if (error < 0 && prot != 0 && va > start) {
+        __mmu_map_range(vas, start, 0, va - start, 0);
+    }
+
+    return error;
+}
+
+/*
+ * Create a virtual to physical mapping of a
+ * specific page size.
+ */
+int
+mmu_map_page(struct vm_vas *vas, struct mmu_map *spec, size_t pgsize, int prot)
+{
+    struct mmu_inval inval = {0};
+    pglvl_t lvl;
+    int error;
+
+    if (vas == NULL || spec == NULL) {
+        return -EINVAL;
+    }
+
+    if ((lvl = mmu_pgsize_level(pgsize)) == MMU_OFF) {
+        return -EINVAL;
+    }
+
+    /* Huge pages must be aligned to their size */
+    if (lvl > MMU_TBL && ((spec->va | spec->pa) & (pgsize - 1)) != 0) {
+        return -EINVAL;
+    }
+
+    error = __mmu_map_page(vas, spec, lvl, prot, &inval);
+    mmu_inval_commit(vas, &inval);
+    return error;
+}
+
+/*
+ * Map a range of pages
+ */
+int
+mmu_map_range(struct vm_vas *vas, struct mmu_map *spec, size_t len, int prot)
+{
+    vaddr_t va;
+    paddr_t pa;
+
+    if (vas == NULL || spec == NULL) {
+        return -EINVAL;
+    }
+
+    if (len == 0 || prot == 0) {
+        return -EINVAL;
+    }
+
+    va = ALIGN_DOWN(spec->va, DEFAULT_PAGESIZE);
+    pa = ALIGN_DOWN(spec->pa, DEFAULT_PAGESIZE);
+    len = ALIGN_UP(len, DEFAULT_PAGESIZE);
+    return __mmu_map_range(vas, va, pa, len, prot);
+}
+
+/*
+ * Unmap a range of pages
+ */
+int
+mmu_unmap_range(struct vm_vas *vas, vaddr_t va, size_t len)
+{
+    if (vas == NULL || len == 0) {
+        return -EINVAL;
+    }
+
+    va = ALIGN_DOWN(va, DEFAULT_PAGESIZE);
+    len = ALIGN_UP(len, DEFAULT_PAGESIZE);
+    return __mmu_map_range(vas, va, 0, len, 0);
+}
+
+/*
+ * Change the protection of mapped pages
+ */
+int
+mmu_protect_range(struct vm_vas *vas, vaddr_t va, size_t len, int prot)
+{
+    struct mmu_inval inval = {0};
+    uint64_t pte_flags = prot_to_pte(prot);
+    uintptr_t *tbl;
+    vaddr_t end;
+    size_t idx;
+    int error = 0;
+
+    if (vas == NULL || len == 0 || prot == 0) {
+        return -EINVAL;
+    }
+
+    va = ALIGN_DOWN(va, DEFAULT_PAGESIZE);
+    end = va + ALIGN_UP(len, DEFAULT_PAGESIZE);
+    while (va < end) {
+        error = mmu_read_level(vas, va, MMU_TBL, &tbl, false);
+        if (error == -EPIPE) {
+            /* Nothing mapped here, skip the whole table */
+            va = ALIGN_DOWN(va, PGSIZE_2M) + PGSIZE_2M;
+            error = 0;
+            continue;
+        }
+
+        if (error < 0) {
+            break;
+        }
+
+        idx = mmu_get_level(va, MMU_TBL);
+        for (; idx < 512 && va < end; ++idx, va += DEFAULT_PAGESIZE) {
+            if (!ISSET(tbl[idx], PTE_P))
+                continue;
+
+            tbl[idx] = (tbl[idx] & PTE_ADDR_MASK) | pte_flags;
+            inval.stale = true;
+            mmu_inval_add(&inval, va);
+        }
+    }
+
+    mmu_inval_commit(vas, &inval);
+    return error;
+}
+
+/*
+ * Look up where a virtual address is mapped to
+ */
+int
+mmu_translate(struct vm_vas *vas, vaddr_t va, paddr_t *pa_res)
+{
+    uintptr_t *cur, ent;
+    pglvl_t lvl = mmu_pg_level();
+    size_t pgsize;
+
+    if (vas == NULL || pa_res == NULL) {
+        return -EINVAL;
+    }
+
+    /* Walk down without touching anything */
+    cur = PHYS_TO_VIRT(vas->cr3 & PTE_ADDR_MASK);
+    for (;;) {
+        ent = cur[mmu_get_level(va, lvl)];
+        if (!ISSET(ent, PTE_P)) {
+            return -ENOENT;
+        }
+
+        if (lvl == MMU_TBL || ISSET(ent, PTE_PS)) {
+            break;
+        }
+
+        cur = PHYS_TO_VIRT(ent & PTE_ADDR_MASK);
+        --lvl;
+    }
+
+    pgsize = mmu_level_pgsize(lvl);
+    *pa_res = (ent & PTE_ADDR_MASK & ~(pgsize - 1)) | (va & (pgsize - 1));
     return 0;
 }
 
+/*
+ * Create a virtual to physical mapping
+ */
+int
+mmu_map_single(struct vm_vas *vas, struct mmu_map *spec, int prot)
+{
+    return mmu_map_page(vas, spec, DEFAULT_PAGESIZE, prot);
+}
+
+/*
+ * Get the largest usable page size
+ */
+size_t
+mmu_pgsize_fit(vaddr_t va, paddr_t pa, size_t len)
+{
+    uintptr_t addr = va | pa;
+
+    if (has_1g && len >= PGSIZE_1G) {
+        if ((addr & (PGSIZE_1G - 1)) == 0)
+            return PGSIZE_1G;
+    }
+
+    if (len >= PGSIZE_2M && (addr & (PGSIZE_2M - 1)) == 0) {
+        return PGSIZE_2M;
+    }
+
+    return DEFAULT_PAGESIZE;
+}
+
 /*
  * Create a new virtual address space
  */
@@ -376,6 +1069,8 @@ mmu_new_vas(struct vm_vas *res)
     }
 
     res->cr3 = VIRT_TO_PHYS(dest);
+    res->tag = atomic_inc_long(&next_tag);
+    memset(res->pcid, 0, sizeof(res->pcid));
     return 0;
 }
 
@@ -385,33 +1080,175 @@ mmu_new_vas(struct vm_vas *res)
 int
 mmu_write_vas(struct vm_vas *vas)
 {
+    struct pcore *core;
+    struct mdcore *md;
+    uint16_t pcid;
+
     if (vas->cr3 == 0) {
         return -EINVAL;
     }
 
-    __mmu_write_cr3(vas->cr3);
+    /*
+     * Let shootdowns know we are on this address space
+     * before checking its tag. Paired with the tag store
+     * in mmu_vas_retag(), either we see the new tag or
+     * the other core sees us and sends an IPI.
+     */
+    core = this_core();
+    if (core != NULL) {
+        atomic_store_64(&core->md.cr3, vas->cr3);
+    }
+
+    if (!has_pcid || vas->tag == 0 || core == NULL) {
+        __mmu_write_cr3(vas->cr3);
+        return 0;
+    }
+
+    /*
+     * If our PCID for this VAS is still tagged with it,
+     * whatever the TLB holds for it is still good.
+     */
+    md = &core->md;
+    pcid = vas->pcid[core->id];
+    if (pcid != 0 && pcid < MMU_NPCID && md->pcid_tag[pcid] == atomic_load_64(&vas->tag)) {
+        __mmu_write_cr3(vas->cr3 | pcid | CR3_NOFLUSH);
+        return 0;
+    }
+
+    /*
+     * Recycle the next PCID, PCID zero is left for
+     * untagged address spaces. Not setting the no-flush
+     * bit flushes whatever the last owner left behind.
+     */
+    if ((pcid = md->pcid_next) == 0) {
+        pcid = 1;
+    }
+
+    md->pcid_next = pcid + 1;
+    if (md->pcid_next >= MMU_NPCID) {
+        md->pcid_next = 1;
+    }
+
+    md->pcid_tag[pcid] = vas->tag;
+    vas->pcid[core->id] = pcid;
+    __mmu_write_cr3(vas->cr3 | pcid);
     return 0;
 }
 
 /*
- * Allocate the frame used for a VAS
+ * Free a VAS along with its user page tables
  */
 int
 mmu_free_vas(struct vm_vas *vas)
 {
-    vm_free_frame(vas->cr3, 1);
+    struct pcore *core = this_core();
+    pglvl_t lvl = mmu_pg_level();
+    uintptr_t *root, ent;
+    uint64_t *slot;
+    uint8_t pcid;
+
+    if (vas == NULL || vas->cr3 == 0) {
+        return -EINVAL;
+    }
+
+    /*
+     * Give back our PCID if we hold one, any other core
+     * that holds one recycles it as it would anyways
+     * since the tag is never handed out again.
+     */
+    pcid = (core != NULL) ? vas->pcid[core->id] : MMU_NPCID;
+    if (vas->tag != 0 && pcid < MMU_NPCID) {
+        slot = &core->md.pcid_tag[pcid];
+        if (*slot == vas->tag) {
+            *slot = 0;
+            if (has_invpcid)
+                __invpcid(INVPCID_CTX, pcid, 0);
+        }
+    }
+
+    /*
+     * Tables in the lower half are ours alone, the higher
+     * half is shared with the kernel and every other VAS.
+     */
+    root = PHYS_TO_VIRT(vas->cr3 & PTE_ADDR_MASK);
+    for (int i = 0; i < 256; ++i) {
+        ent = root[i];
+        if (!ISSET(ent, PTE_P) || ISSET(ent, PTE_PS)) {
+            continue;
+        }
+
+        mmu_free_table(ent & PTE_ADDR_MASK, lvl - 1);
+        root[i] = 0;
+    }
+
+    vm_free_frame(vas->cr3 & PTE_ADDR_MASK, 1);
     vas->cr3 = 0;
+    vas->tag = 0;
     return 0;
 }
 
+/*
+ * Collect a page table along with every table
+ * below it.
+ *
+ * @tbl_pa: Physical address of the table
+ * @lvl: Level of the table
+ * @res: Frames are written here
+ * @max: Max number of entries in 'res'
+ * @n: Number of frames so far
+ *
+ * Returns the new number of frames
+ */
+static size_t
+mmu_collect_table(paddr_t tbl_pa, pglvl_t lvl, uintptr_t *res,
+    size_t max, size_t n)
+{
+    uintptr_t *tbl = PHYS_TO_VIRT(tbl_pa);
+    uintptr_t ent;
+
+    if (n < max) {
+        res[n] = tbl_pa;
+    }
+
+    ++n;
+    for (int i = 0; i < 512 && lvl > MMU_TBL; ++i) {
+        ent = tbl[i];
+        if (!ISSET(ent, PTE_P) || ISSET(ent, PTE_PS)) {
+            continue;
+        }
+
+        n = mmu_collect_table(ent & PTE_ADDR_MASK, lvl - 1, res, max, n);
+    }
+
+    return n;
+}
+
+/*
+ * Collect the page tables of the kernel VAS
+ */
+size_t
+mmu_kvas_tables(uintptr_t *res, size_t max)
+{
+    if (res == NULL) {
+        max = 0;
+    }
+
+    return mmu_collect_table(
+        g_kvas.cr3 & PTE_ADDR_MASK,
+        mmu_pg_level(),
+        res, max, 0
+    );
+}
+
 /*
  * Set caching attributes
  */
 int
 mmu_set_cache(struct vm_vas *vas, vaddr_t va, cacheattr_t attr)
 {
+    struct mmu_inval inval = {0};
     uintptr_t *pte, pa;
-    uint32_t flags;
+    uint64_t flags;
     int error;
     size_t idx;
 
@@ -425,6 +1262,10 @@ mmu_set_cache(struct vm_vas *vas, vaddr_t va, cacheattr_t attr)
         return -EINVAL;
     }
 
+    idx = mmu_get_level(va, MMU_TBL);
+    pa = pte[idx] & PTE_ADDR_MASK;
+    flags = pte[idx] & ~PTE_ADDR_MASK;
+
     /* Uncachable? */
     if (ISSET(attr, MMU_CACHE_UC)) {
         flags |= PTE_PCD;
@@ -445,10 +1286,104 @@ mmu_set_cache(struct vm_vas *vas, vaddr_t va, cacheattr_t attr)
 
     /* Update attributes and flush the TLB */
     pte[idx] = pa | flags;
-    __invlpg((void *)va);
+    inval.stale = true;
+    mmu_inval_add(&inval, va);
+    mmu_inval_commit(vas, &inval);
     return 0;
 }
 
+/*
+ * Enable PCIDs on the current processor if they are
+ * supported, called by each core during configuration.
+ */
+void
+mmu_pcid_init(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    CPUID(0x01, eax, ebx, ecx, edx);
+    if (!ISSET(ecx, BIT(17))) {
+        return;
+    }
+
+    /* Leaf 7 needs a subleaf */
+    __ASMV(
+        "cpuid"
+        : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+        : "a" (0x07), "c" (0)
+    );
+
+    has_invpcid = ISSET(ebx, BIT(10)) != 0;
+
+    /* CR3[11:0] must be clear before setting CR4.PCIDE */
+    __mmu_write_cr3(__mmu_read_cr3() & PTE_ADDR_MASK);
+    __mmu_write_cr4(__mmu_read_cr4() | CR4_PCIDE);
+    has_pcid = true;
+}
+
+/*
+ * Time switching between two address spaces that
+ * each touch a set of pages, once with PCIDs and
+ * once flushing on every switch.
+ */
+static void
+mmu_bench_switch(void)
+{
+    const size_t NPAGES = 64;
+    const size_t NROUNDS = 1000;
+    const vaddr_t BENCH_VA = 0x10000000;
+    struct vm_vas kvas, vas[2], flush[2];
+    struct mmu_map spec;
+    volatile uint8_t *p;
+    uint64_t cycles[2], start, intr;
+    paddr_t pa;
+
+    pa = vm_alloc_frame(NPAGES);
+    mmu_this_vas(&kvas);
+    for (int i = 0; i < 2; ++i) {
+        mmu_new_vas(&vas[i]);
+        spec.va = BENCH_VA;
+        spec.pa = pa;
+        mmu_map_range(&vas[i], &spec, NPAGES * DEFAULT_PAGESIZE, PROT_READ);
+    }
+
+    /* Untagged copies flush on every switch */
+    flush[0] = vas[0];
+    flush[1] = vas[1];
+    flush[0].tag = 0;
+    flush[1].tag = 0;
+
+    intr = md_intr_save();
+    for (int run = 0; run < 2; ++run) {
+        start = md_cycles();
+        for (size_t i = 0; i < NROUNDS * 2; ++i) {
+            mmu_write_vas((run == 0) ? &vas[i & 1] : &flush[i & 1]);
+            p = (void *)BENCH_VA;
+            for (size_t j = 0; j < NPAGES; ++j) {
+                (void)p[j * DEFAULT_PAGESIZE];
+            }
+        }
+
+        cycles[run] = (md_cycles() - start) / (NROUNDS * 2);
+    }
+
+    mmu_write_vas(&kvas);
+    md_intr_restore(intr);
+
+    printf(
+        "mmu_bench: switch+touch %d pages: pcid=%d cycles, flush=%d cycles%s\n",
+        NPAGES, cycles[0], cycles[1],
+        has_pcid ? "" : " (no pcid)"
+    );
+
+    for (int i = 0; i < 2; ++i) {
+        mmu_unmap_range(&vas[i], BENCH_VA, NPAGES * DEFAULT_PAGESIZE);
+        mmu_free_vas(&vas[i]);
+    }
+
+    vm_free_frame(pa, NPAGES);
+}
+
 /*
  * Verify that we are in a known state
  */
@@ -457,6 +1392,7 @@ mmu_init(void)
 {
     struct pcore *self = this_core();
     struct mdcore *core;
+    uint32_t edx, unused;
 
     if (self == NULL) {
         panic("mmu_init: could not get core\n");
@@ -473,7 +1409,19 @@ mmu_init(void)
         panic("mmu_init: processor not using L4 paging\n");
     }
 
-    core->cr3 = __mmu_read_cr3();
+    pg_level = MMU_L4;
+
+    /* Can we use 1 GiB pages? */
+    CPUID(0x80000001, unused, unused, unused, edx);
+    has_1g = ISSET(edx, BIT(26)) != 0;
+
+    core->cr3 = __mmu_read_cr3() & PTE_ADDR_MASK;
     g_kvas.cr3 = core->cr3;
+
+    /* Should we benchmark address space switches? */
+    if (PCID_BENCH) {
+        mmu_bench_switch();
+    }
+
     return 0;
 }
@@ -39,7 +39,11 @@
 #include <sys/cpuvar.h>
 #include <sys/syslog.h>
 #include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/proc.h>
+#include <vm/fault.h>
 #include <machine/trap.h>
+#include <machine/fpu.h>
 #include <string.h>
 
 /*
@@ -59,9 +63,18 @@ static const char *trapstr[] = {
     [TRAP_PROTFLT]      = "general protection",
     [TRAP_PAGEFLT]      = "page fault",
     [TRAP_NMI]          = "non-maskable interrupt",
-    [TRAP_SS]           = "stack-segment fault"
+    [TRAP_SS]           = "stack-segment fault",
+    [TRAP_NM]           = "device not available"
 };
 
+/* Page fault error code bits */
+#define PF_P    BIT(0)      /* Page was present */
+#define PF_W    BIT(1)      /* Write access */
+#define PF_X    BIT(4)      /* Instruction fetch */
+
+/* Highest user address */
+#define USER_MAX 0x00007FFFFFFFFFFF
+
 /*
  * Page fault flags (bit relative)
  */
@@ -210,9 +223,48 @@ trap_syscall(struct trapframe *tf)
     }
 }
 
+/*
+ * Try to resolve a page fault on a user address by
+ * backing it with memory.
+ *
+ * @tf: Trapframe of the fault
+ *
+ * Returns zero if the faulting access may be retried.
+ */
+static int
+pf_resolve(struct trapframe *tf)
+{
+    uintptr_t addr = pf_faultaddr();
+    struct proc *self;
+    int access = PROT_READ;
+
+    if (addr > USER_MAX || (self = proc_self()) == NULL) {
+        return -EFAULT;
+    }
+
+    if (ISSET(tf->error_code, PF_W)) {
+        access |= PROT_WRITE;
+    }
+    if (ISSET(tf->error_code, PF_X)) {
+        access |= PROT_EXEC;
+    }
+    if (ISSET(tf->error_code, PF_P)) {
+        access |= VM_FAULT_PRESENT;
+    }
+
+    return vm_fault(self, addr, access);
+}
+
 void
 trap_handler(struct trapframe *tf)
 {
+    if (tf->trapno == TRAP_PAGEFLT && pf_resolve(tf) == 0) {
+        return;
+    }
+    if (tf->trapno == TRAP_NM && fpu_trap() == 0) {
+        return;
+    }
+
     trapframe_dump(tf);
     if (ISSET(tf->cs, 3)) {
         handle_ufault();
@@ -35,7 +35,10 @@
 #include <os/clkdev.h>
 #include <os/iotap.h>
 #include <os/spinlock.h>
+#include <os/wchan.h>
+#include <os/workq.h>
 #include <machine/intr.h>
+#include <machine/mdcpu.h>
 #include <machine/i8042var.h>
 #include <machine/pio.h>
 #include <stdbool.h>
@@ -64,7 +67,14 @@ struct keybuf {
 /* I/O tap forward declarations */
 static struct iotap_ops tap_port0_ops;
 static struct iotap_desc tap_port0;
-static struct proc *kbd_poll_td;
+
+/*
+ * Scancodes are only read in from the IRQ, turning them
+ * into characters is left to the workqueue.
+ */
+static struct spinlock raw_lock;
+static struct keybuf raw_buf = {0};
+static struct work kbd_work;
 
 /* Key states */
 static bool shift_key = false;
@@ -128,27 +138,35 @@ keybuf_enter(struct keybuf *kbp, uint8_t scancode)
         return;
     }
 
+    spinlock_acquire(&lock);
     if (kbp->head >= RING_NENT) {
+        spinlock_release(&lock);
         return;
     }
 
-    spinlock_acquire(&lock);
     kbp->ring[kbp->head++] = scancode;
     spinlock_release(&lock);
+
+    /* Let readers know there is something now */
+    wchan_wakeup(kbp);
 }
 
 /*
- * Pop a character from the scancode buffer
+ * Pop a byte from a key buffer
+ *
+ * @kbp: Key buffer to pop from
+ * @res: Byte is written here
  *
- * Returns the scancode on success, otherwise
- * a less than zero errno value.
+ * XXX: Bytes are returned through `res' as scancodes
+ *      with bit 7 set are key releases.
+ *
+ * Returns zero on success, otherwise a less than
+ * zero errno value (-EAGAIN if empty).
  */
-static int8_t
-keybuf_pop(struct keybuf *kbp)
+static int
+keybuf_pop(struct keybuf *kbp, uint8_t *res)
 {
-    uint8_t tail;
-
-    if (kbp == NULL) {
+    if (kbp == NULL || res == NULL) {
         return -EINVAL;
     }
 
@@ -156,12 +174,12 @@ keybuf_pop(struct keybuf *kbp)
         return -EAGAIN;
     }
 
-    tail = kbp->ring[kbp->tail++];
+    *res = kbp->ring[kbp->tail++];
     if (kbp->tail >= RING_NENT) {
         kbp->tail = 0;
         kbp->head = 0;
     }
-    return tail;
+    return 0;
 }
 
 /*
@@ -172,13 +190,13 @@ i8042_read_tap(struct iotap_desc *desc, void *p, size_t len)
 {
     size_t maxlen, i = 0;
     char *pbuf = p;
-    int8_t scancode;
+    uint8_t c;
 
     /* Truncate if needed */
     spinlock_acquire(&lock);
     maxlen = keybuf_len(&buf);
     if (len == 0) {
-        goto done;
+        spinlock_release(&lock);
         return -EAGAIN;
     }
 
@@ -188,22 +206,25 @@ i8042_read_tap(struct iotap_desc *desc, void *p, size_t len)
      * return -EAGAIN.
      */
     for (i = 0; i < MIN(len, maxlen); ++i) {
-        scancode = keybuf_pop(&buf);
-        spinlock_release(&lock);
-
         /* Failed and haven't read anything? */
-        if (scancode < 0) {
+        if (keybuf_pop(&buf, &c) < 0) {
             break;
         }
 
-        if (i < len) {
-            pbuf[i] = scancode;
-        }
+        pbuf[i] = c;
     }
 
-done:
-    spinlock_release(&lock);
-    return (i == 0) ? -EAGAIN : i;
+    if (i > 0) {
+        spinlock_release(&lock);
+        return i;
+    }
+
+    /*
+     * Nothing is here yet, sleep until a key comes in
+     * rather than having the reader spin on us.
+     */
+    wchan_sleep(&buf, &lock);
+    return -EAGAIN;
 }
 
 /*
@@ -341,34 +362,79 @@ i8042_getc(uint8_t sc, char *chr)
 }
 
 /*
- * IRQ 1 handler
+ * Turn the scancodes we have read in so far into
+ * characters for readers.
  */
-static int
-i8042_irq(struct intr_hand *hp)
+static void
+i8042_drain(void *p)
 {
     char c;
     uint8_t scancode;
+    uint64_t intr;
     int error;
 
-    scancode = i8042_read();
-    if (i8042_getc(scancode, &c) == 0) {
-        keybuf_enter(&buf, c);
+    for (;;) {
+        intr = md_intr_save();
+        spinlock_acquire(&raw_lock);
+        error = keybuf_pop(&raw_buf, &scancode);
+        spinlock_release(&raw_lock);
+        md_intr_restore(intr);
+
+        if (error < 0) {
+            break;
+        }
+
+        if (i8042_getc(scancode, &c) == 0) {
+            keybuf_enter(&buf, c);
+        }
+    }
+}
+
+/*
+ * Stash a scancode for i8042_drain()
+ */
+static void
+i8042_stash(uint8_t scancode)
+{
+    spinlock_acquire(&raw_lock);
+    if (raw_buf.head < RING_NENT) {
+        raw_buf.ring[raw_buf.head++] = scancode;
     }
+    spinlock_release(&raw_lock);
+}
+
+/*
+ * IRQ 1 handler
+ */
+static int
+i8042_irq(struct intr_hand *hp)
+{
+    /* The data is there if we got the IRQ */
+    i8042_stash(inb(I8042_DATA));
+    if (work_queue(&kbd_work) == -ENXIO) {
+        i8042_drain(NULL);
+    }
+
     return 1;
 }
 
+/*
+ * Poll for scancodes, this runs from the workqueue
+ * every I8042_DELAY msecs.
+ */
 static void
 i8042_poll(void *p)
 {
-    char c;
-    uint8_t scancode;
+    uint64_t intr;
 
-    for (;;) {
-        scancode = i8042_read();
-        if (i8042_getc(scancode, &c) == 0) {
-            keybuf_enter(&buf, c);
-        }
+    while (ISSET(inb(I8042_STATUS), I8042_OBUFF)) {
+        intr = md_intr_save();
+        i8042_stash(inb(I8042_DATA));
+        md_intr_restore(intr);
     }
+
+    i8042_drain(NULL);
+    work_queue_delayed(&kbd_work, I8042_DELAY * 1000);
 }
 
 /*
@@ -426,9 +492,11 @@ i8042_init(struct module *modp)
      * poll.
      */
     if (!I8042_POLL) {
+        work_init(&kbd_work, i8042_drain, NULL);
         i8042_init_intr();
     } else {
-        proc_ktd(&kbd_poll_td, i8042_poll);
+        work_init(&kbd_work, i8042_poll, NULL);
+        work_queue_delayed(&kbd_work, I8042_DELAY * 1000);
     }
 
     /* Enable I/O taps */
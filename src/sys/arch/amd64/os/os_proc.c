@@ -38,11 +38,13 @@
 #include <machine/gdt.h>
 #include <machine/frame.h>
 #include <machine/lapic.h>
+#include <machine/tlb.h>
+#include <machine/fpu.h>
 #include <os/kalloc.h>
+#include <os/wchan.h>
+#include <os/callout.h>
 #include <string.h>
 
-extern struct proc g_rootproc;
-
 /*
  * Put the current process into userland for its first
  * run. The catch is that we have never been in userland
@@ -56,6 +58,7 @@ md_proc_kick(struct proc *procp)
     struct trapframe *tfp = &pcbp->tf;
 
     mmu_write_vas(&pcbp->vas);
+    fpu_load(this_core(), procp);
     lapic_timer_oneshot_us(SCHED_QUANTUM);
 
     __ASMV(
@@ -82,12 +85,39 @@ md_proc_kick(struct proc *procp)
     __builtin_unreachable();
 }
 
+/*
+ * Give up the core after going to sleep
+ */
 void
-md_proc_sleep(void)
+md_proc_yield(void)
 {
-    /* Wait for the timer to go off */
-    lapic_timer_oneshot_us(4000);
-    __ASMV("sti; hlt; cli");
+    struct pcore *core = this_core();
+    struct proc *self;
+
+    if (core == NULL || (self = core->curproc) == NULL) {
+        return;
+    }
+
+    /*
+     * A syscall runs with interrupts masked, this goes off
+     * right as we iret back to userland.
+     */
+    md_sched_kick(core);
+    if (!ISSET(self->flags, PROC_KTD)) {
+        return;
+    }
+
+    /*
+     * Kernel threads have a stack of their own and may be
+     * switched away from right here, we come back once
+     * someone wakes us up.
+     *
+     * XXX: Kernel threads always run with interrupts on
+     */
+    md_inton();
+    while (ISSET(self->flags, PROC_SLEEPING)) {
+        md_spinwait();
+    }
 }
 
 /*
@@ -100,7 +130,7 @@ md_proc_init(struct proc *procp, int flags)
     struct trapframe *tfp;
     struct mmu_map spec;
     uint8_t cs, ds;
-    int error;
+    int error, prot;
 
     if (procp == NULL) {
         return -EINVAL;
@@ -121,12 +151,14 @@ md_proc_init(struct proc *procp, int flags)
         cs = USER_CS | 3;
     }
 
+    prot = PROT_READ | PROT_WRITE | PROT_USER;
+
     /*
      * Set up the mapping specifier, we'll use zero
      * to allocate new pages.
      */
     spec.pa = 0;
-    spec.va = STACK_TOP;
+    spec.va = (STACK_TOP + 1) - STACK_LEN;
 
     /* Put the trapframe in a known state */
     tfp = &pcbp->tf;
@@ -135,19 +167,74 @@ md_proc_init(struct proc *procp, int flags)
     tfp->cs = cs;
     tfp->ss = ds;
 
-    /* Map the stack */
-    vm_map(
-        &pcbp->vas, &spec,
-        STACK_LEN,
-        PROT_READ
-        | PROT_WRITE
-        | PROT_USER
-    );
+    /*
+     * User stacks are faulted in as they grow, a kernel
+     * thread cannot take a fault on its own stack so it
+     * gets all of it up front. A forked child inherits
+     * the stack of its parent.
+     */
+    if (ISSET(flags, SPAWN_FORK)) {
+        error = 0;
+    } else if (!ISSET(flags, SPAWN_KTD)) {
+        error = vm_reserve(
+            procp, spec.va,
+            STACK_LEN, prot,
+            VM_RANGE_STACK
+        );
+    } else {
+        error = vm_map(&pcbp->vas, &spec, STACK_LEN, prot);
+        if (error == 0) {
+            spinlock_acquire(&procp->maplist_lock);
+            error = proc_add_range(
+                procp, spec.va, spec.pa,
+                STACK_LEN, prot,
+                VM_RANGE_OWNED
+            );
+            spinlock_release(&procp->maplist_lock);
+        }
+    }
+
+    if (error < 0) {
+        printf("md_proc_init: could not map stack\n");
+        return error;
+    }
 
     tfp->rsp = STACK_TOP;
     return 0;
 }
 
+/*
+ * MD fork code
+ */
+int
+md_proc_fork(struct proc *child, struct proc *parent)
+{
+    struct trapframe *tfp;
+
+    if (child == NULL || parent == NULL) {
+        return -EINVAL;
+    }
+
+    /*
+     * The trapframe of the parent was saved on syscall
+     * entry, the child resumes there with a return
+     * value of zero.
+     */
+    tfp = &child->pcb.tf;
+    memcpy(tfp, &parent->pcb.tf, sizeof(*tfp));
+    tfp->rax = 0;
+    return fpu_fork(child, parent);
+}
+
+/*
+ * MD proc teardown
+ */
+void
+md_proc_free(struct proc *procp)
+{
+    fpu_free(procp);
+}
+
 /*
  * Process idle loop
  */
@@ -161,12 +248,12 @@ md_proc_idle(void)
     lapic_eoi();
 
     /*
-     * Set the oneshot timer and check if there is
-     * any procs in our runqueues. If not, wait for
-     * it to fire again.
+     * Go through the scheduler right away, it keeps the
+     * timer stopped from there on if there is nothing to
+     * do and we stay halted until another core kicks us.
      */
+    lapic_timer_oneshot_us(1);
     for (;;) {
-        lapic_timer_oneshot_us(9000);
         __ASMV("sti; hlt");
     }
 }
@@ -196,6 +283,7 @@ md_sched_switch(struct trapframe *tf)
     struct proc *self, *proc = NULL;
     struct md_pcb *pcbp;
     struct pcore *core;
+    size_t usec;
     int error;
 
     if ((core = this_core()) == NULL) {
@@ -203,26 +291,41 @@ md_sched_switch(struct trapframe *tf)
         goto done;
     }
 
-    /* Don't switch if no self */
-    if ((self = core->curproc) != NULL) {
-        error = sched_enq(&core->scq, self);
-        if (error < 0) {
-            goto done;
-        }
+    /* Anything we wake up here is in the running too */
+    callout_run(core);
 
+    /* Don't switch if no self */
+    self = core->curproc;
+    sched_preempt(core, self);
+    if (self != NULL) {
         /*
          * Save the current trapframe to our process control
-         * block as we'll want it later when we're back.
+         * block as we'll want it later when we're back. This
+         * must happen before it is queued as another core
+         * may take it as soon as it is.
          */
         pcbp = &self->pcb;
         memcpy(&pcbp->tf, tf, sizeof(*tf));
+        fpu_save(core, self);
+
+        /*
+         * Sleepers are queued by whoever wakes them, the
+         * idle thread is always there to take over.
+         */
+        error = 0;
+        if (!wchan_park(self)) {
+            error = sched_enq(&core->scq, self);
+        }
+        if (error < 0) {
+            goto done;
+        }
     }
 
     /*
      * Grab the next process. If we cannot find any, assume
      * we are the only one and continue on...
      */
-    error = sched_deq(&core->scq, &proc);
+    error = sched_next(core, &proc);
     if (error < 0) {
         goto done;
     }
@@ -231,12 +334,66 @@ md_sched_switch(struct trapframe *tf)
     pcbp = &proc->pcb;
     memcpy(tf, &pcbp->tf, sizeof(*tf));
     core->curproc = proc;
+    proc->core = core;
 
-    /* Switch the address space and hope for the best */
+    /*
+     * Pick up any invalidations queued for us while we
+     * are here rather than waiting on the IPI, then
+     * switch the address space and hope for the best.
+     */
+    tlb_drain();
     mmu_write_vas(&pcbp->vas);
 done:
+    /*
+     * Whatever we return to is a process which never runs
+     * on the stack the bootloader gave this core.
+     */
+    proc = NULL;
+    if (core != NULL && (proc = core->curproc) != NULL) {
+        core->booted = true;
+    }
+
+    /* The FPU state is only loaded once it is used */
+    fpu_load(core, proc);
+
+    /*
+     * Only arm the timer if something needs it, e.g., if
+     * anything else is waiting to run.
+     */
     lapic_eoi();
-    lapic_timer_oneshot_us(SCHED_QUANTUM);
+    if ((usec = sched_next_event(core, proc)) != 0) {
+        lapic_timer_oneshot_us(usec);
+    } else {
+        lapic_timer_halt();
+    }
+}
+
+/*
+ * Kick a core into the scheduler
+ */
+void
+md_sched_kick(struct pcore *core)
+{
+    struct lapic_ipi ipi = {
+        .shorthand = IPI_SHAND_NONE,
+        .delmod = IPI_DELMOD_FIXED,
+        .vector = LAPIC_TIMER_VEC,
+        .apic_id = 0,
+        .dest_mode = IPI_DESTMODE_PHYSICAL
+    };
+
+    if (core == NULL) {
+        return;
+    }
+
+    /* Going through the timer vector gets us the trapframe */
+    if (core == this_core()) {
+        ipi.shorthand = IPI_SHAND_SELF;
+    } else {
+        ipi.apic_id = core->md.apic_id;
+    }
+
+    lapic_tx_ipi(&ipi);
 }
 
 /*
@@ -245,12 +402,7 @@ done:
 int
 md_proc_kill(struct proc *procp, int flags)
 {
-    const size_t PSIZE = DEFAULT_PAGESIZE;
-    struct proc *self;
-    struct penv_blk *envblk;
     struct pcore *core = this_core();
-    struct md_pcb *pcbp;
-    struct vm_range *range;
 
     if (core == NULL) {
         return -ENXIO;
@@ -261,37 +413,19 @@ md_proc_kill(struct proc *procp, int flags)
         procp = core->curproc;
     }
 
-    /* Free every range */
-    TAILQ_FOREACH(range, &procp->maplist, link) {
-        if (range == NULL) {
-            continue;
-        }
-
-        vm_free_frame(range->pa_base, range->len / PSIZE);
-    }
-
-    if ((envblk = procp->envblk) != NULL) {
-        ptrbox_terminate(procp->envblk_box);
-        kfree(envblk->argv);
-        procp->envblk = NULL;
-    }
-
-    /* Release the VAS */
-    pcbp = &procp->pcb;
-    mmu_free_vas(&pcbp->vas);
-
-    /* Sanity check */
-    if ((self = core->curproc) == NULL) {
-        printf("kill: could not get self, using rootproc\n");
-        self = &g_rootproc;
-    }
-
-    /* If this is us, spin time */
-    if (self->pid == procp->pid) {
+    /*
+     * If this is us, get off of our address space before
+     * handing ourselves to the reaper, it will be torn down
+     * from under us otherwise. Then spin time.
+     */
+    if (procp == core->curproc) {
+        mmu_write_vas(&g_kvas);
         core->curproc = NULL;
+        proc_reap(procp);
         md_proc_idle();
     }
 
+    proc_reap(procp);
     return 0;
 }
 
@@ -53,7 +53,7 @@ sys_cross(struct syscall_args *scargs)
     struct proc *self = proc_self();
     int error;
 
-    error = proc_check_addr(self, (uintptr_t)res, len);
+    error = proc_check_addr(self, (uintptr_t)res, len, PROT_WRITE);
     if (error < 0) {
         return error;
     }
@@ -97,7 +97,10 @@ sys_query(struct syscall_args *scargs)
         return error;
     }
 
-    error = proc_check_addr(self, (uintptr_t)u_data, u_datalen);
+    error = proc_check_addr(
+        self, (uintptr_t)u_data,
+        u_datalen, PROT_WRITE
+    );
     if (error < 0) {
         return error;
     }
@@ -31,6 +31,7 @@
 #include <sys/signal.h>
 #include <sys/cdefs.h>
 #include <sys/proc.h>
+#include <sys/mman.h>
 #include <os/signal.h>
 
 /*
@@ -82,16 +83,26 @@ sys_sigaction(struct syscall_args *scargs)
     sap = SCARG(scargs, struct sigaction *, 1);
     sap_old = SCARG(scargs, struct sigaction *, 2);
 
-    /* Sigactions at a valid address? */
-    error = proc_check_addr(self, (uintptr_t)sap, sizeof(*sap));
-    if (error < 0) {
-        return error;
+    /* Sigactions at a valid address? (NULL leaves it be) */
+    if (sap != NULL) {
+        error = proc_check_addr(
+            self, (uintptr_t)sap,
+            sizeof(*sap), PROT_READ
+        );
+        if (error < 0) {
+            return error;
+        }
     }
 
-    /* Old sigactions at a valid address? */
-    error = proc_check_addr(self, (uintptr_t)sap_old, sizeof(sap_old));
-    if (error < 0) {
-        return error;
+    /* Old sigactions at a valid address? (NULL to skip) */
+    if (sap_old != NULL) {
+        error = proc_check_addr(
+            self, (uintptr_t)sap_old,
+            sizeof(*sap_old), PROT_WRITE
+        );
+        if (error < 0) {
+            return error;
+        }
     }
 
     return do_sigaction(sig, sap, sap_old);
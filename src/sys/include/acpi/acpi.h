@@ -56,6 +56,29 @@ size_t acpi_get_root_sdt_len(void);
  */
 void *acpi_get_root_sdt(void);
 
+/*
+ * Get a table listed in the root system descriptor
+ * table
+ *
+ * @idx: Index of table
+ *
+ * Returns NULL if the index is out of bounds
+ */
+struct acpi_header *acpi_get_table(size_t idx);
+
+/*
+ * Copy every table listed in the root system descriptor
+ * table out of firmware memory so the memory holding
+ * them can be reclaimed.
+ *
+ * XXX: Pointers to tables that were handed out before
+ *      this call are left pointing to the old copies.
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int acpi_copy_tables(void);
+
 /*
  * Query for an ACPI table
  *
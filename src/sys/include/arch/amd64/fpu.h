@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _MACHINE_FPU_H_
+#define _MACHINE_FPU_H_ 1
+
+#include <sys/types.h>
+
+/* Values returned by simd_init() */
+#define SIMD_AVX    0       /* SSE and AVX */
+#define SIMD_SSE    1       /* SSE only */
+#define SIMD_NONE   -1      /* Nothing */
+
+struct proc;
+struct pcore;
+
+/*
+ * Set up lazy FPU switching on the current core
+ *
+ * @simd: What simd_init() found (SIMD_*)
+ */
+void fpu_init(int simd);
+
+/*
+ * Handle a device not available trap, the current
+ * process gets its FPU state loaded.
+ *
+ * Returns zero if the faulting instruction may be
+ * retried.
+ */
+int fpu_trap(void);
+
+/*
+ * Save the FPU state of a process that is being
+ * switched away from, this is a no-op unless it is
+ * live on this core. It must be done before the
+ * process may run anywhere else.
+ *
+ * @core: Current core
+ * @proc: Process being switched away from
+ */
+void fpu_save(struct pcore *core, struct proc *proc);
+
+/*
+ * Get the FPU ready for a process that is about to
+ * run, the next FPU instruction traps unless its
+ * state is still loaded on this core.
+ *
+ * @core: Current core
+ * @proc: Process about to run (may be NULL)
+ */
+void fpu_load(struct pcore *core, struct proc *proc);
+
+/*
+ * Give a child a copy of the FPU state of its parent
+ *
+ * @child: Child process
+ * @parent: Current process that forked
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on failure.
+ */
+int fpu_fork(struct proc *child, struct proc *parent);
+
+/*
+ * Release the FPU save area of a process
+ *
+ * @proc: Process to release the area of
+ */
+void fpu_free(struct proc *proc);
+
+#endif  /* !_MACHINE_FPU_H_ */
@@ -130,7 +130,8 @@
         lfence                     ;\
         swapgs                     ;\
         sti                        ;\
-    2:  iretq
+    2:  add $8, %rsp               ;\
+        iretq
 
 #define TRAP_ENTRY(NAME, TRAPNO)    \
     NAME:                           \
@@ -148,6 +149,7 @@
         lfence                     ;\
         swapgs                     ;\
         sti                        ;\
-    2:  iretq
+    2:  add $8, %rsp               ;\
+        iretq
 
 #endif  /* !_MACHINE_FRAMEASM_H_ */
@@ -112,4 +112,10 @@ void lapic_eoi(void);
  */
 void lapic_timer_oneshot_us(size_t usec);
 
+/*
+ * Stop the Local APIC timer of the current core,
+ * it stays stopped until it is armed again.
+ */
+void lapic_timer_halt(void);
+
 #endif  /* !_MACHINE_LAPIC_H_ */
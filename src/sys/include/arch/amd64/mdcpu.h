@@ -32,16 +32,79 @@
 
 #include <sys/types.h>
 #include <sys/cdefs.h>
+#include <sys/param.h>
 #include <machine/tss.h>
 #include <machine/gdt.h>
+#include <machine/tlb.h>
 
 #define HALT_VECTOR 0x90
+#define TLB_VECTOR  0x91
+
+/* Number of PCIDs handed out per core */
+#define MMU_NPCID 64
 
 #define md_spinwait() __ASMV("pause")
 #define md_intoff()   __ASMV("cli")
 #define md_inton()    __ASMV("sti")
 #define md_halt()     __ASMV("hlt")
 
+/*
+ * Read the timestamp counter, useful for measuring
+ * short intervals in processor cycles.
+ */
+__always_inline static inline uint64_t
+md_cycles(void)
+{
+    uint32_t lo, hi;
+
+    __ASMV(
+        "rdtsc"
+        : "=a" (lo), "=d" (hi)
+        :
+        : "memory"
+    );
+
+    return COMBINE32(hi, lo);
+}
+
+/*
+ * Mask interrupts on the current processor and
+ * return the previous interrupt state.
+ */
+__always_inline static inline uint64_t
+md_intr_save(void)
+{
+    uint64_t rflags;
+
+    __ASMV(
+        "pushfq\n"
+        "pop %0\n"
+        "cli"
+        : "=r" (rflags)
+        :
+        : "memory"
+    );
+
+    return rflags;
+}
+
+/*
+ * Restore an interrupt state returned by
+ * md_intr_save()
+ *
+ * @state: State to restore
+ */
+__always_inline static inline void
+md_intr_restore(uint64_t state)
+{
+    /* Was RFLAGS.IF set? */
+    if (ISSET(state, BIT(9))) {
+        md_inton();
+    }
+}
+
+struct proc;
+
 #define CPU_VENDOR_OTHER  0x00
 #define CPU_VENDOR_AMD    0x01
 #define CPU_VENDOR_INTEL  0x02
@@ -51,7 +114,8 @@
  * of a processor core on the machine.
  *
  * @apic_id: Local APIC ID
- * @cr3: CR3 register value (PML<n> phys)
+ * @cr3: CR3 register value (PML<n> phys), kept current
+ *       so shootdowns know which cores to interrupt
  * @vendor: Processor vendor (CPU_VENDOR_*)
  * @family: Processor family ID
  * @lapic_base: LAPIC register interface base
@@ -60,6 +124,10 @@
  * @lapic_tmr_freq: Local APIC timer frequency
  * @gdt: Global descriptor table instance
  * @gdtr: GDT descriptor
+ * @pcid_tag: VAS tag that owns each PCID
+ * @pcid_next: Next PCID to recycle
+ * @tlbq: Invalidations queued by other cores
+ * @fpu_owner: Process whose FPU state was last loaded
  */
 struct mdcore {
     uint32_t apic_id;
@@ -72,6 +140,10 @@ struct mdcore {
     size_t lapic_tmr_freq;
     struct gdt_entry gdt[GDT_ENTRY_COUNT];
     struct gdtr gdtr;
+    uint64_t pcid_tag[MMU_NPCID];
+    uint16_t pcid_next;
+    struct tlb_queue tlbq;
+    struct proc *fpu_owner;
 };
 
 #endif  /* !_MACHINE_MDCPU_H_ */
@@ -33,15 +33,21 @@
 #include <machine/vas.h>
 #include <machine/frame.h>
 
+struct pcore;
+
 /*
  * Represents MD specific process data
  *
  * @vas: Current virtual address space
  * @tf: Processor state save
+ * @fpu: FPU/SIMD save area, allocated on first use
+ * @fpu_core: Core that last loaded @fpu
  */
 struct md_pcb {
     struct vm_vas vas;
     struct trapframe tf;
+    void *fpu;
+    struct pcore *fpu_core;
 };
 
 #endif  /* _MACHINE_PCB_H_ */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MACHINE_TLB_H_
+#define _MACHINE_TLB_H_ 1
+
+#include <sys/types.h>
+#include <sys/cdefs.h>
+#include <os/spinlock.h>
+#include <stdbool.h>
+
+/*
+ * Max number of pages a core can have queued for
+ * invalidation, past this it flushes everything.
+ */
+#define TLB_QUEUE_MAX 32
+
+/*
+ * Per-core queue of invalidations other cores have
+ * asked for. Senders bump `req' each time they queue
+ * something and the owner sets `done' to it once the
+ * queue has been drained.
+ *
+ * @va: Page bases to invalidate
+ * @count: Number of pages in `va'
+ * @all: Flush the whole TLB instead
+ * @req: Request ticket, bumped by senders
+ * @done: Last ticket handled by the owner
+ * @lock: Protects this queue
+ */
+struct tlb_queue {
+    vaddr_t va[TLB_QUEUE_MAX];
+    size_t count;
+    bool all;
+    volatile uint64_t req;
+    volatile uint64_t done;
+    struct spinlock lock;
+};
+
+/*
+ * Enable PCIDs on the current processor if they are
+ * supported, called by each core during configuration.
+ */
+void mmu_pcid_init(void);
+
+/*
+ * Invalidate a set of pages from the TLB of the
+ * current processor only.
+ *
+ * @va: Page bases to invalidate
+ * @count: Number of pages in `va'
+ * @all: If true, flush the whole TLB instead
+ */
+void mmu_flush_local(const vaddr_t *va, size_t count, bool all);
+
+/*
+ * Invalidate a set of pages on every other core that
+ * has the address space described by `cr3' loaded and
+ * wait for them to finish. All the pages are sent in
+ * a single interrupt per core.
+ *
+ * @cr3: Root table of the target VAS, zero for all cores
+ * @va: Page bases to invalidate
+ * @count: Number of pages in `va'
+ * @all: If true, flush the whole TLB instead
+ */
+void tlb_shootdown(paddr_t cr3, const vaddr_t *va, size_t count, bool all);
+
+/*
+ * Handle any invalidations queued for the current
+ * processor.
+ */
+void tlb_drain(void);
+
+#endif  /* !_MACHINE_TLB_H_ */
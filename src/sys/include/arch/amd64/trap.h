@@ -47,6 +47,7 @@
 #define TRAP_PAGEFLT        10      /* Page fault */
 #define TRAP_NMI            11      /* Non-maskable interrupt */
 #define TRAP_SS             12      /* Stack-segment fault */
+#define TRAP_NM             13      /* Device not available (FPU) */
 
 #if !defined(__ASSEMBLER__)
 
@@ -58,6 +59,7 @@ void invl_op(void *sf);
 void double_fault(void *sf);
 void invl_tss(void *sf);
 void segnp(void *sf);
+void dev_na(void *sf);
 void general_prot(void *sf);
 void page_fault(void *sf);
 void nmi(void *sf);
@@ -30,15 +30,22 @@
 #ifndef _MACHINE_VAS_H_
 #define _MACHINE_VAS_H_ 1
 
+#include <sys/limits.h>
 #include <vm/vm.h>
 
 /*
  * Represents the current virtual address
  *
  * @cr3: The value of CR3 for this VAS
+ * @tag: Unique tag that changes whenever translations
+ *       are taken away (zero if never tagged)
+ * @pcid: PCID last used for this VAS on each core,
+ *        indexed by core ID (hint)
  */
 struct vm_vas {
     paddr_t cr3;
+    uint64_t tag;
+    uint8_t pcid[CPU_MAX];
 };
 
 #endif  /* !_MACHINE_VAS_H_ */
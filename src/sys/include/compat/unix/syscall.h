@@ -104,7 +104,10 @@ scret_t(*g_unix_sctab[])(struct syscall_args *) = {
     [SYS_listen] = sys_listen,
     [SYS_seteuid] = sys_seteuid,
     [SYS_mmap] = sys_mmap,
-    [SYS_usleep] = sys_usleep
+    [SYS_usleep] = sys_usleep,
+    [SYS_fork] = sys_fork,
+    [SYS_munmap] = sys_munmap,
+    [SYS_mprotect] = sys_mprotect
 };
 
 #endif  /* !_NEED_UNIX_SCTAB */
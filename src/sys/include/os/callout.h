@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _OS_CALLOUT_H_
+#define _OS_CALLOUT_H_ 1
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <os/spinlock.h>
+#include <stdbool.h>
+
+/*
+ * Each core has a hashed timer wheel, a callout goes in
+ * the slot of the tick it expires on and is only fired
+ * once the wheel comes around to it in the right round.
+ *
+ * CALLOUT_TICK_USEC is the width of a slot in usecs and
+ * CALLOUT_NSLOT is the number of slots.
+ */
+#define CALLOUT_TICK_USEC 1000
+#define CALLOUT_NSLOT 256
+
+struct pcore;
+struct callout_wheel;
+
+/*
+ * A callout calls a function once a given amount
+ * of time has passed.
+ *
+ * @fn: Function to call (from interrupt context)
+ * @arg: Argument to pass to 'fn'
+ * @expire: Time it expires at in usecs since boot
+ * @wheel: Wheel it is pending on, NULL if not pending
+ * @due: Expired and about to be fired
+ * @link: Wheel slot link
+ */
+struct callout {
+    void(*fn)(void *);
+    void *arg;
+    size_t expire;
+    struct callout_wheel *wheel;
+    bool due;
+    TAILQ_ENTRY(callout) link;
+};
+
+/*
+ * A per-core timer wheel
+ *
+ * @slot: Pending callouts by tick they expire on
+ * @expired: Callouts that are about to be fired
+ * @lock: Protects the wheel
+ * @tick: Last tick that was processed
+ * @next: Earliest expiry of anything pending (usecs)
+ * @npending: Number of callouts pending
+ */
+struct callout_wheel {
+    TAILQ_HEAD(, callout) slot[CALLOUT_NSLOT];
+    TAILQ_HEAD(, callout) expired;
+    struct spinlock lock;
+    size_t tick;
+    size_t next;
+    size_t npending;
+};
+
+/*
+ * Get the time in usecs since boot
+ *
+ * Returns zero if there is no clock to use
+ */
+size_t callout_time(void);
+
+/*
+ * Arm a callout on the wheel of the current core, if
+ * it was already pending it is moved.
+ *
+ * @cop: Callout to arm
+ * @usec: Usecs from now it should fire in
+ * @fn: Function to call
+ * @arg: Argument to pass to 'fn'
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on failure.
+ */
+int callout_reset(struct callout *cop, size_t usec, void(*fn)(void *),
+    void *arg);
+
+/*
+ * Disarm a callout
+ *
+ * @cop: Callout to disarm
+ *
+ * Returns zero if it was pending, otherwise a less
+ * than zero value.
+ */
+int callout_stop(struct callout *cop);
+
+/*
+ * Fire every callout on the wheel of a core that has
+ * expired, this is called when the core goes through
+ * the scheduler.
+ *
+ * @core: Current core
+ *
+ * Returns the number of callouts fired
+ */
+size_t callout_run(struct pcore *core);
+
+/*
+ * Get the time until the next callout on a core
+ * expires
+ *
+ * @core: Core to check
+ *
+ * Returns the time in usecs, zero if nothing is
+ * pending.
+ */
+size_t callout_next_event(struct pcore *core);
+
+/*
+ * Initialize a timer wheel
+ *
+ * @wheel: Wheel to initialize
+ */
+void callout_wheel_init(struct callout_wheel *wheel);
+
+#endif  /* !_OS_CALLOUT_H_ */
@@ -97,6 +97,26 @@ struct filedesc *fd_get(struct proc *procp, int fd);
  */
 int fdtab_init(struct proc *procp);
 
+/*
+ * Copy the file descriptor table of one process into
+ * another, the vnodes are shared between both.
+ *
+ * @dst: Process to copy into
+ * @src: Process to copy from
+ *
+ * Returns zero on success, less than zero values
+ * indicate failure.
+ */
+int fdtab_copy(struct proc *dst, struct proc *src);
+
+/*
+ * Close every file descriptor of a process and
+ * release its table entries
+ *
+ * @procp: Process of fd table to free
+ */
+void fdtab_free(struct proc *procp);
+
 /*
  * Open a file
  *
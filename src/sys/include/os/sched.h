@@ -34,20 +34,66 @@
 #include <sys/queue.h>
 #include <sys/proc.h>
 #include <os/spinlock.h>
+#include <stdbool.h>
 
+/*
+ * Quantum of the highest priority level in usecs, each
+ * level below it gets twice the quantum of the one
+ * above it.
+ */
 #define SCHED_QUANTUM 10000
 #define SCHED_NQUEUES 4
 
 /*
- * Represents a queue of processes
+ * Every process is moved back up to the highest level
+ * once this many usecs worth of quanta have been handed
+ * out from a queue, this keeps the lower levels from
+ * starving.
+ */
+#define SCHED_BOOST_USEC 1000000
+
+/*
+ * A process that was queued fewer than this many ticks
+ * ago (i.e., dispatches from its queue) is considered
+ * to be cache hot on its core and is not migrated.
  *
- * @q; Actual queue
+ * XXX: This must be at least one, a core queues the
+ *      process it is switching away from before it
+ *      picks the next one.
+ */
+#define SCHED_HOT_TICKS 1
+
+struct pcore;
+
+/*
+ * Represents a per-core multi-level feedback queue,
+ * processes start out in the highest level (zero) and
+ * sink a level each time they use up their quantum.
+ *
+ * @q: Runnable processes for each level
+ * @idle: Idle thread of the core, never migrated
+ * @core: Core that owns this queue
+ * @lock: Protects the queue
  * @nproc: Number of processes in this queue
+ * @nrun: Number of runnable processes in this queue
+ * @elapsed: Usecs handed out since the last boost
+ * @ticks: Number of processes dispatched from this queue
+ * @tickless: The core has no timer armed
+ * @idling: The core has nothing to run
+ * @kicked: The core was interrupted to pick up work
  */
 struct sched_queue {
-    TAILQ_HEAD(, proc) q;
+    TAILQ_HEAD(, proc) q[SCHED_NQUEUES];
+    struct proc *idle;
+    struct pcore *core;
     struct spinlock lock;
-    size_t nproc;
+    volatile size_t nproc;
+    volatile size_t nrun;
+    size_t elapsed;
+    size_t ticks;
+    volatile bool tickless;
+    volatile bool idling;
+    volatile bool kicked;
 };
 
 /*
@@ -57,6 +103,17 @@ struct sched_queue {
  */
 void md_sched_switch(struct trapframe *tf);
 
+/*
+ * Interrupt a core so it goes through the scheduler,
+ * this is used to wake up cores that have no timer
+ * armed.
+ *
+ * [MD]
+ *
+ * @core: Core to interrupt
+ */
+void md_sched_kick(struct pcore *core);
+
 /*
  * Enqueue a new process to a queue
  *
@@ -79,6 +136,86 @@ int sched_enq(struct sched_queue *q, struct proc *proc);
  */
 int sched_deq(struct sched_queue *q, struct proc **procp);
 
+/*
+ * Pick the next process to run on a core, if the
+ * queue of the core is empty a process is taken from
+ * the busiest core. The idle thread of the core is
+ * used as a last resort.
+ *
+ * @core: Core to pick for
+ * @procp: Result of the picked process is written here
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value if there is nothing to run.
+ */
+int sched_next(struct pcore *core, struct proc **procp);
+
+/*
+ * Initialize a scheduler queue
+ *
+ * @q: Queue to initialize
+ * @core: Core that owns the queue
+ */
+void sched_queue_init(struct sched_queue *q, struct pcore *core);
+
+/*
+ * Get the quantum of a process
+ *
+ * @proc: Process to query, NULL gives the default
+ *
+ * Returns the quantum in usecs
+ */
+size_t sched_quantum(struct proc *proc);
+
+/*
+ * Move a process that used up its quantum down
+ * a level.
+ *
+ * @proc: Process to demote
+ */
+void sched_demote(struct proc *proc);
+
+/*
+ * Handle a process being switched away from, it is
+ * demoted unless the core was only kicked to pick up
+ * new work before its quantum ran out.
+ *
+ * @core: Current core
+ * @proc: Process being switched away from (may be NULL)
+ */
+void sched_preempt(struct pcore *core, struct proc *proc);
+
+/*
+ * Get the time until the next event a core must be
+ * interrupted for, e.g., the end of the quantum of its
+ * process if anything else wants to run.
+ *
+ * @core: Current core
+ * @proc: Process the core is about to run (may be NULL)
+ *
+ * Returns the time in usecs, zero means there is nothing
+ * to wait for and the timer may be stopped.
+ */
+size_t sched_next_event(struct pcore *core, struct proc *proc);
+
+/*
+ * Interrupt a core so it goes through the scheduler
+ * without its process being charged for it, e.g., to
+ * have it look at its timer again.
+ *
+ * @core: Core to kick
+ */
+void sched_kick(struct pcore *core);
+
+/*
+ * Move a process up to the highest level, this is
+ * to be used when a process is waiting on I/O as it
+ * should not have to wait behind batch jobs.
+ *
+ * @proc: Process to boost
+ */
+void sched_boost(struct proc *proc);
+
 /*
  * Initialize the scheduler into a basic
  * known state.
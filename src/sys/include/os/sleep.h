@@ -33,6 +33,20 @@
 #include <sys/types.h>
 #include <sys/syscall.h>
 
+/*
+ * Put the current process to sleep, other processes
+ * get to run in the meantime.
+ *
+ * XXX: Like any other sleep, a process in a syscall
+ *      only stops running once it is back out of it.
+ *
+ * @usec: Number of usecs to sleep for
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value if there is no timer to wait on.
+ */
+int proc_usleep(size_t usec);
+
 /*
  * Sleep for n microseconds
  */
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _OS_WCHAN_H_
+#define _OS_WCHAN_H_ 1
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/proc.h>
+#include <os/spinlock.h>
+#include <stdbool.h>
+
+/*
+ * Wait channels are hashed into 1 << WCHAN_SHIFT
+ * sleep queues.
+ */
+#define WCHAN_SHIFT 6
+#define WCHAN_NBUCKET (1 << WCHAN_SHIFT)
+
+/*
+ * A sleep queue holds every process sleeping on any
+ * of the wait channels that hash to it.
+ *
+ * @q: Sleeping processes
+ * @lock: Protects the queue
+ */
+struct sleepq {
+    TAILQ_HEAD(, proc) q;
+    struct spinlock lock;
+};
+
+/*
+ * Put the current process to sleep on a wait channel
+ * until someone calls wchan_wakeup() on it.
+ *
+ * XXX: A process in a syscall shares the kernel stack of
+ *      its core, it is switched away from on its way back
+ *      out to userland, i.e., the syscall still returns
+ *      first. Kernel threads are switched away from right
+ *      here.
+ *
+ * @chan: Wait channel, any address will do
+ * @lock: Lock protecting the condition being waited on,
+ *        it is released once we are on the sleep queue
+ *        and is not taken back (may be NULL)
+ */
+void wchan_sleep(const void *chan, struct spinlock *lock);
+
+/*
+ * Wake up every process sleeping on a wait channel,
+ * each goes back on the runqueue of the core it last
+ * ran on.
+ *
+ * @chan: Wait channel to wake
+ *
+ * Returns the number of processes woken up
+ */
+size_t wchan_wakeup(const void *chan);
+
+/*
+ * Called when a process is switched away from, if it is
+ * still asleep it is marked as off of its core and the
+ * waker becomes responsible for queueing it.
+ *
+ * @proc: Process being switched away from
+ *
+ * Returns true if the process must not be queued
+ */
+bool wchan_park(struct proc *proc);
+
+/*
+ * Initialize the sleep queues
+ */
+void wchan_init(void);
+
+#endif  /* !_OS_WCHAN_H_ */
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _OS_WORKQ_H_
+#define _OS_WORKQ_H_ 1
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <os/spinlock.h>
+#include <os/callout.h>
+
+/* Work flags */
+#define WORK_QUEUED  BIT(0)     /* On the queue of a worker */
+#define WORK_DELAYED BIT(1)     /* Waiting on its timer */
+
+struct proc;
+struct workq;
+
+/*
+ * A work item is a function to be called later on
+ * from a worker thread, i.e., not from interrupt
+ * context.
+ *
+ * @fn: Function to call
+ * @arg: Argument to pass to 'fn'
+ * @wq: Queue it is pending on, NULL if not pending
+ * @owner: Queue it was last queued on
+ * @flags: Work flags (WORK_*)
+ * @timer: Timer for delayed work
+ * @link: Queue link
+ */
+struct work {
+    void(*fn)(void *);
+    void *arg;
+    struct workq *volatile wq;
+    struct workq *owner;
+    uint8_t flags;
+    struct callout timer;
+    TAILQ_ENTRY(work) link;
+};
+
+/*
+ * Each core has a queue of work and a worker thread
+ * bound to it that runs through it.
+ *
+ * @q: Pending work
+ * @lock: Protects the queue
+ * @current: Work the worker is running right now
+ * @td: Worker thread
+ */
+struct workq {
+    TAILQ_HEAD(, work) q;
+    struct spinlock lock;
+    struct work *current;
+    struct proc *td;
+};
+
+/*
+ * Initialize a work item
+ *
+ * @wp: Work item to initialize
+ * @fn: Function to call
+ * @arg: Argument to pass to 'fn'
+ */
+void work_init(struct work *wp, void(*fn)(void *), void *arg);
+
+/*
+ * Queue work on the current core, this may be used
+ * from interrupt context.
+ *
+ * @wp: Work to queue
+ *
+ * Returns zero on success, -EALREADY if it is already
+ * pending, otherwise a less than zero value on failure.
+ */
+int work_queue(struct work *wp);
+
+/*
+ * Queue work on the current core once some time has
+ * passed.
+ *
+ * @wp: Work to queue
+ * @usec: Usecs to wait before queueing it
+ *
+ * Returns zero on success, -EALREADY if it is already
+ * pending, otherwise a less than zero value on failure.
+ */
+int work_queue_delayed(struct work *wp, size_t usec);
+
+/*
+ * Take pending work off of its queue (or timer)
+ *
+ * @wp: Work to cancel
+ *
+ * Returns zero if it was pending, otherwise a less
+ * than zero value.
+ */
+int work_cancel(struct work *wp);
+
+/*
+ * Wait until work is no longer pending nor running
+ *
+ * XXX: Only kernel threads may wait here (see wchan_sleep())
+ *      and a work item may not flush work on its own core.
+ *
+ * @wp: Work to wait on
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int work_flush(struct work *wp);
+
+/*
+ * Start the worker threads, every core must be up
+ * by now.
+ */
+void workq_init(void);
+
+#endif  /* !_OS_WORKQ_H_ */
@@ -48,8 +48,8 @@ atomic_add_int_nv(volatile unsigned int *p, unsigned int v)
     return __sync_add_and_fetch(p, v);
 }
 
-static inline unsigned int
-atomic_add_64_nv(volatile uint64_t *p, unsigned int v)
+static inline uint64_t
+atomic_add_64_nv(volatile uint64_t *p, uint64_t v)
 {
     return __sync_add_and_fetch(p, v);
 }
@@ -66,8 +66,8 @@ atomic_sub_int_nv(volatile unsigned int *p, unsigned int v)
     return __sync_sub_and_fetch(p, v);
 }
 
-static inline unsigned int
-atomic_sub_64_nv(volatile uint64_t *p, unsigned int v)
+static inline uint64_t
+atomic_sub_64_nv(volatile uint64_t *p, uint64_t v)
 {
     return __sync_sub_and_fetch(p, v);
 }
@@ -78,13 +78,13 @@ atomic_load_int_nv(volatile unsigned int *p, unsigned int v)
     return __atomic_load_n(p, v);
 }
 
-static inline unsigned int
+static inline unsigned long
 atomic_load_long_nv(volatile unsigned long *p, unsigned int v)
 {
     return __atomic_load_n(p, v);
 }
 
-static inline unsigned int
+static inline uint64_t
 atomic_load_64_nv(volatile uint64_t *p, unsigned int v)
 {
     return __atomic_load_n(p, v);
@@ -108,6 +108,26 @@ atomic_store_64_nv(volatile uint64_t *p, long nv, unsigned int v)
     __atomic_store_n(p, nv, v);
 }
 
+/*
+ * Compare and swap a pointer, returns the
+ * previous value.
+ */
+static inline void *
+atomic_cas_ptr(volatile void *p, void *cmp, void *nv)
+{
+    return __sync_val_compare_and_swap((void *volatile *)p, cmp, nv);
+}
+
+/*
+ * Swap a pointer, returns the previous
+ * value.
+ */
+static inline void *
+atomic_swap_ptr(volatile void *p, void *nv)
+{
+    return __atomic_exchange_n((void *volatile *)p, nv, __ATOMIC_SEQ_CST);
+}
+
 /* Atomic increment (and fetch) operations */
 #define atomic_inc_long(P) atomic_add_long_nv((P), 1)
 #define atomic_inc_int(P) atomic_add_int_nv((P), 1)
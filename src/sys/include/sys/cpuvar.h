@@ -36,6 +36,8 @@
 #include <sys/param.h>
 #if defined(_KERNEL)
 #include <os/sched.h>
+#include <os/callout.h>
+#include <vm/physseg.h>
 #include <machine/mdcpu.h>
 #endif  /* _KERNEL */
 
@@ -47,6 +49,9 @@
  * @id: Monotonic logical ID
  * @curproc: Current process running
  * @scq: Scheduler queue
+ * @pcache: Per-core frame cache
+ * @wheel: Timer wheel
+ * @booted: Core is done with its boot stack
  * @md: Machine dependent processor information
  * @self: Chain pointer to self
  */
@@ -55,6 +60,9 @@ struct pcore {
     struct proc *curproc;
 #if defined(_KERNEL)
     struct sched_queue scq;
+    struct vm_pcache pcache;
+    struct callout_wheel wheel;
+    volatile bool booted;
     struct mdcore md;
 #endif  /* _KERNEL */
     struct pcore *self;
@@ -63,21 +71,25 @@ struct pcore {
 #if defined(_KERNEL)
 
 typedef enum {
-    CORE_ARBITER_RR,    /* Round robin */
+    CORE_ARBITER_RR,        /* Round robin */
+    CORE_ARBITER_LEAST,     /* Least loaded core */
+    CORE_ARBITER_P2C,       /* Less loaded of two random cores */
+    CORE_ARBITER_AFFINE     /* Current core unless it is busier */
 } arbiter_type_t;
 
 /*
  * The processor core arbiter assists in scheduling
- * processor cores to be used for execution.
+ * processor cores to be used for execution, it is
+ * lock-free so concurrent spawns never serialize.
  *
  * @rr_id: Round robin ID; next processor to be scheduled
- * @type: Arbitration policy (CORE_ARBITER_RR is default)
- * @lock: Protects the ID
+ * @seq: Sequence used to derive random picks
+ * @type: Arbitration policy (CORE_ARBITER_P2C is default)
  */
 struct core_arbiter {
-    size_t rr_id;
+    volatile size_t rr_id;
+    volatile size_t seq;
     arbiter_type_t type;
-    struct spinlock lock;
 } __aligned(COHERENCY_UNIT);
 
 /*
@@ -130,6 +142,15 @@ void cpu_init(struct pcore *pcore);
  */
 struct pcore *cpu_get(uint16_t index);
 
+/*
+ * Get the number of processor cores that are
+ * currently online, valid logical IDs for cpu_get()
+ * range from zero up to this value.
+ *
+ * [MD]
+ */
+size_t cpu_count(void);
+
 /*
  * Get the current processing element (core) as
  * a 'pcore' descriptor.
@@ -48,4 +48,14 @@
  */
 void *mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off);
 
+/*
+ * Unmap memory pages
+ */
+int munmap(void *addr, size_t len);
+
+/*
+ * Change the protection of memory pages
+ */
+int mprotect(void *addr, size_t len, int prot);
+
 #endif  /* !_SYS_MMAN_H_ */
@@ -41,16 +41,27 @@
 #include <os/mac.h>
 #include <os/signal.h>
 #include <os/spinlock.h>
+#include <os/callout.h>
 #include <os/filedesc.h>
 #include <vm/vm.h>
 #include <machine/pcb.h>    /* standard */
 #endif  /* _KERNEL */
 
 /*
- * The stack starts here and grows down
+ * The stack starts here and grows down, starting
+ * at STACK_LEN and growing on demand up to STACK_MAX
  */
 #define STACK_TOP   0xBFFFFFFF
 #define STACK_LEN   4096
+#define STACK_MAX   0x800000
+
+/*
+ * PIDs are handed out below PID_MAX and looked up
+ * through a hash table of PIDHASH_SIZE chains, both
+ * must be powers of two.
+ */
+#define PID_MAX       32768
+#define PIDHASH_SIZE  256
 
 /*
  * Process environment block, used to store arguments
@@ -66,6 +77,8 @@ struct penv_blk {
 
 #if defined(_KERNEL)
 
+struct pcore;
+
 /*
  * A process describes a running program image
  * on the system.
@@ -80,7 +93,15 @@ struct penv_blk {
  * @level: Access level
  * @maplist_lock: Protects the maplist
  * @sigtab: Signal table
- * @maplist: List of mapped regions
+ * @maplist: Tree of mapped regions
+ * @mmap_hint: Where the next mmap() search starts
+ * @last_range: Range found by the last lookup
+ * @sched_lvl: Scheduler queue level (see os/sched.h)
+ * @sched_stamp: Queue tick the process was last queued at
+ * @core: Core the process last ran on
+ * @wchan: Wait channel the process is sleeping on
+ * @sleep_timer: Wakes the process up from usleep()
+ * @lup_link: PID hash chain link
  * @link: TAILQ link
  */
 struct proc {
@@ -96,7 +117,14 @@ struct proc {
     mac_level_t level;
     struct spinlock maplist_lock;
     sigtab_t sigtab;
-    TAILQ_HEAD(, vm_range) maplist;
+    struct vm_range_tree maplist;
+    vaddr_t mmap_hint;
+    struct vm_range *last_range;
+    uint8_t sched_lvl;
+    size_t sched_stamp;
+    struct pcore *core;
+    const void *wchan;
+    struct callout sleep_timer;
     TAILQ_ENTRY(proc) lup_link;
     TAILQ_ENTRY(proc) link;
 };
@@ -104,9 +132,13 @@ struct proc {
 #define PROC_EXITING BIT(0)     /* Process is exiting */
 #define PROC_SLEEPING BIT(1)    /* Process is sleeping */
 #define PROC_KTD BIT(2)         /* Process is kernel thread */
+#define PROC_IDLE BIT(3)        /* Process is an idle thread */
+#define PROC_PARKED BIT(4)      /* Process is asleep and off of its core */
+#define PROC_PINNED BIT(5)      /* Process never leaves its core */
 
 /* Flags for PROC_SPAWN */
 #define SPAWN_KTD BIT(0)        /* Spawn kernel thread */
+#define SPAWN_FORK BIT(1)       /* Leave the address space empty */
 
 /*
  * Initialize a process into a basic minimal
@@ -128,18 +160,59 @@ struct proc *proc_self(void);
 
 /*
  * Allocate a range descriptor and add it to the
- * process's range tracking list for cleanup upon
- * exit.
+ * process's range tree for cleanup upon exit.
+ *
+ * XXX: The caller must hold `maplist_lock'
  *
  * @procp: Process to initialize the range of
  * @va: Virtual address to use
  * @pa: Physical address to use
  * @len: Length to use
+ * @prot: Protection flags of the range (PROT_*)
+ * @flags: Range flags (VM_RANGE_*)
  *
- * Returns zero on success, otherwise a less than
- * zero value upon error.
+ * Returns zero on success, -EEXIST if it overlaps
+ * another range, otherwise a less than zero value
+ * upon error.
+ */
+int proc_add_range(struct proc *procp, vaddr_t va, paddr_t pa, size_t len,
+    int prot, int flags);
+
+/*
+ * Remove a range from a process and release its
+ * descriptor, the memory behind it is left alone.
+ *
+ * XXX: The caller must hold `maplist_lock'
+ *
+ * @procp: Process to remove the range from
+ * @range: Range to remove
+ */
+void proc_del_range(struct proc *procp, struct vm_range *range);
+
+/*
+ * Find the range of a process that contains a
+ * specific virtual address.
+ *
+ * XXX: The caller must hold `maplist_lock'
+ *
+ * @procp: Process to search
+ * @va: Virtual address to look up
+ *
+ * Returns NULL if no range contains `va'
+ */
+struct vm_range *proc_find_range(struct proc *procp, vaddr_t va);
+
+/*
+ * Duplicate a process, the child shares the memory
+ * of the parent copy-on-write and returns to the same
+ * place with a return value of zero.
+ *
+ * @parent: Process to duplicate
+ *
+ * Returns the PID of the child on success, otherwise
+ * a less than zero value on error
  */
-int proc_add_range(struct proc *procp, vaddr_t va, paddr_t pa, size_t len);
+int proc_fork(struct proc *parent);
 
 /*
  * Spawn a kernel thread
@@ -149,6 +222,27 @@ int proc_add_range(struct proc *procp, vaddr_t va, paddr_t pa, size_t len);
  */
 int proc_ktd(struct proc **procp_res, void(*fn)(void *));
 
+/*
+ * Spawn the idle thread of a processor core, this
+ * only runs when the core has nothing else to run
+ * and cannot take work from any other core.
+ *
+ * @core: Core the thread is bound to
+ * @fn: Function where kernel thread should end up
+ */
+int proc_idle_td(struct pcore *core, void(*fn)(void *));
+
+/*
+ * Spawn a kernel thread that is bound to a specific
+ * processor core, it is never taken by another core.
+ *
+ * @core: Core the thread is bound to
+ * @procp_res: Result is written here
+ * @fn: Function where kernel thread should end up
+ */
+int proc_bound_td(struct pcore *core, struct proc **procp_res,
+    void(*fn)(void *));
+
 /*
  * Kill a process with a specific status code
  *
@@ -160,16 +254,41 @@ int proc_ktd(struct proc **procp_res, void(*fn)(void *));
  */
 int proc_kill(struct proc *procp, int status);
 
+/*
+ * Hand a dead process to the reaper, everything it
+ * holds is released later on in the reaper thread.
+ *
+ * XXX: The process may not be on any runqueue or core
+ *
+ * @procp: Process to reap
+ */
+void proc_reap(struct proc *procp);
+
+/*
+ * Release everything a process holds along with
+ * the process itself.
+ *
+ * XXX: The process may not be on any runqueue or core
+ *
+ * @procp: Process to free
+ */
+void proc_free(struct proc *procp);
+
 /*
  * Spawn a process from a binary
  *
  * @path: Path to binary
  * @envp: Environment block pointer
+ * @envbox: Pointer box holding the arguments of 'envp'
+ *
+ * XXX: The new process owns 'envp' and 'envbox' from
+ *      here on, even if this fails.
  *
  * Returns the PID of the new process on success,
  * otherwise a less than zero value on error
  */
-int proc_spawn(const char *path, struct penv_blk *envbp);
+int proc_spawn(const char *path, struct penv_blk *envbp,
+    struct ptrbox *envbox);
 
 /*
  * Initialize machine dependent state of a process
@@ -183,8 +302,29 @@ int proc_spawn(const char *path, struct penv_blk *envbp);
 int md_proc_init(struct proc *procp, int flags);
 
 /*
- * Machine dependent kill routine which cleans up
- * things that exist within the process control block
+ * Copy the machine dependent state of a process into
+ * its child after a fork.
+ *
+ * @child: Child process
+ * @parent: Process that forked
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value to indicate failure.
+ */
+int md_proc_fork(struct proc *child, struct proc *parent);
+
+/*
+ * Release the machine dependent state of a process
+ * that is being freed.
+ *
+ * @procp: Process being freed
+ */
+void md_proc_free(struct proc *procp);
+
+/*
+ * Machine dependent kill routine which takes the
+ * process off of the core and hands it to the reaper,
+ * this does not return if it is the current process.
  *
  * @procp: Process to kill
  * @flags: Optional flags to use
@@ -208,33 +348,36 @@ int md_set_ip(struct proc *procp, uintptr_t ip);
 
 /*
  * Check that a virtual address is within the bounds of
- * a process.
+ * a process and may be accessed as requested.
  *
  * @proc: Process the address should be within
  * @addr: Virtual address to check
  * @len: Length of memory referenced by 'addr'
+ * @prot: Access needed (PROT_READ and/or PROT_WRITE)
  *
  * Returns zero if the address is within the process bounds,
  * otherwise a less than zero value on failure.
  */
-int proc_check_addr(struct proc *proc, uintptr_t addr, size_t len);
+int proc_check_addr(struct proc *proc, uintptr_t addr, size_t len, int prot);
 
 /*
- * Put a process to sleep
+ * Put the current process to sleep on its own wait
+ * channel (see os/wchan.h)
  *
- * @proc: Process to put to sleep
+ * @proc: Process to put to sleep, must be the current one
  *
  * Returns zero on success
  */
 int proc_sleep(struct proc *proc);
 
 /*
- * Wake up a process
+ * Wake up everything sleeping on the wait channel of
+ * a process, this is also done when it exits.
  *
  * @proc: Process to wake up
  *
- * Returns zero if the address is within the process bounds,
- * otherwise a less than zero value on failure.
+ * Returns zero if anything was woken up, otherwise a
+ * less than zero value on failure.
  */
 int proc_wake(struct proc *proc);
 
@@ -248,10 +391,48 @@ int proc_wake(struct proc *proc);
 struct proc *proc_lookup(pid_t pid);
 
 /*
- * Put the current process to sleep until woken
- * up
+ * Allocate a PID, freed PIDs are handed out again
+ * once the ones above them have been used.
+ *
+ * Returns the PID on success, otherwise -EAGAIN if
+ * every PID is in use.
+ */
+pid_t pid_alloc(void);
+
+/*
+ * Release a PID so it may be reused
+ *
+ * @pid: PID to release
+ */
+void pid_free(pid_t pid);
+
+/*
+ * Make a process visible to proc_lookup()
+ *
+ * @procp: Process to insert
+ */
+void proc_hash_insert(struct proc *procp);
+
+/*
+ * Hide a process from proc_lookup(), this does nothing
+ * if it was never inserted.
+ *
+ * @procp: Process to remove
+ */
+void proc_hash_remove(struct proc *procp);
+
+/*
+ * Orphan every child of a process
+ *
+ * @parent: Process whose children to orphan
+ */
+void proc_orphan(struct proc *parent);
+
+/*
+ * Give up the core after the current process was put
+ * to sleep, see wchan_sleep() for when this happens.
  */
-void md_proc_sleep(void);
+void md_proc_yield(void);
 
 /*
  * Put the current process into a halt loop
@@ -271,6 +452,11 @@ __dead void md_proc_kick(struct proc *procp);
  */
 scret_t sys_spawn(struct syscall_args *scargs);
 
+/*
+ * Duplicate the current process
+ */
+scret_t sys_fork(struct syscall_args *scargs);
+
 /*
  * Get argument number n
  */
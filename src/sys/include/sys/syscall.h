@@ -64,6 +64,9 @@
 #define SYS_seteuid     0x13    /* set effective UID */
 #define SYS_mmap        0x14    /* map a virtual address */
 #define SYS_usleep      0x15    /* Sleep for n microseconds */
+#define SYS_fork        0x16    /* duplicate the process */
+#define SYS_munmap      0x17    /* unmap a virtual address */
+#define SYS_mprotect    0x18    /* change page protection */
 
 typedef __ssize_t scret_t;
 typedef __ssize_t scarg_t;
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _VM_FAULT_H_
+#define _VM_FAULT_H_ 1
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <vm/vm.h>
+
+struct proc;
+
+/*
+ * Set in the access flags of vm_fault() if the page
+ * was mapped when the fault was taken.
+ */
+#define VM_FAULT_PRESENT BIT(8)
+
+/*
+ * Handle a page fault on a user address by allocating
+ * a frame for it if it lies within a lazy range of the
+ * process, a few pages around it may be mapped ahead
+ * of time as well. Writes to pages shared since fork()
+ * get a private copy of the page.
+ *
+ * @procp: Process that faulted
+ * @va: Faulting virtual address
+ * @access: Type of access that faulted (PROT_*, VM_FAULT_*)
+ *
+ * Returns zero if the fault was resolved, otherwise a
+ * less than zero value if the access was bad.
+ */
+int vm_fault(struct proc *procp, vaddr_t va, int access);
+
+/*
+ * Grow the stack range of a process down so that it
+ * covers a specific address, no frames are allocated.
+ *
+ * XXX: The caller must hold `maplist_lock'
+ *
+ * @procp: Process whose stack to grow
+ * @va: Address the stack should cover
+ *
+ * Returns the stack range on success, otherwise NULL
+ * if `va' is past the stack limit or in the way of
+ * another range.
+ */
+struct vm_range *vm_stack_grow(struct proc *procp, vaddr_t va);
+
+#endif  /* !_VM_FAULT_H_ */
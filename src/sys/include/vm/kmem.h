@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _VM_KMEM_H_
+#define _VM_KMEM_H_ 1
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/cdefs.h>
+#include <sys/queue.h>
+#include <os/spinlock.h>
+#include <stdbool.h>
+
+/* Number of objects a per-core magazine can hold */
+#define KMEM_MAG_SIZE 15
+
+struct kmem_slab;
+
+/*
+ * Per-core magazine of free objects, this sits in
+ * front of the slab layer so the common path does
+ * not need to take the cache lock.
+ *
+ * @objs: Stack of free objects
+ * @count: Number of objects in the magazine
+ */
+struct kmem_mag {
+    void *objs[KMEM_MAG_SIZE];
+    size_t count;
+} __aligned(COHERENCY_UNIT);
+
+/*
+ * Describes a cache of fixed size objects
+ *
+ * @name: Name of the cache (for diagnostics)
+ * @objsize: Size of each object
+ * @ctor: Constructor called once per object
+ * @slab_pages: Number of frames per slab
+ * @nobjs: Number of objects per slab
+ * @mags: Per-core magazines (indexed by core ID)
+ * @partial: Slabs with at least one free object
+ * @full: Slabs with no free objects
+ * @empty: Spare slab with every object free
+ * @lock: Protects the slab lists
+ * @is_init: Set when the cache has been set up
+ */
+struct kmem_cache {
+    const char *name;
+    size_t objsize;
+    void(*ctor)(void *obj);
+    size_t slab_pages;
+    size_t nobjs;
+    struct kmem_mag *mags;
+    TAILQ_HEAD(, kmem_slab) partial;
+    TAILQ_HEAD(, kmem_slab) full;
+    struct kmem_slab *empty;
+    struct spinlock lock;
+    volatile bool is_init;
+};
+
+/*
+ * Static initializer for an object cache, caches
+ * are set up lazily on first allocation.
+ *
+ * @NAME: Name of the cache
+ * @SIZE: Size of each object
+ * @CTOR: Optional object constructor (or NULL)
+ */
+#define KMEM_CACHE_INIT(NAME, SIZE, CTOR)   \
+    {                                       \
+        .name = (NAME),                     \
+        .objsize = (SIZE),                  \
+        .ctor = (CTOR),                     \
+        .is_init = false                    \
+    }
+
+/*
+ * Allocate an object from a cache
+ *
+ * @cp: Cache to allocate from
+ *
+ * XXX: Objects are in the state left by the constructor
+ *      (or by the last user), they are not zeroed.
+ *
+ * Returns NULL on failure
+ */
+void *kmem_cache_alloc(struct kmem_cache *cp);
+
+/*
+ * Return an object to its cache
+ *
+ * @cp: Cache the object was allocated from
+ * @obj: Object to free
+ *
+ * XXX: Objects of caches with a constructor must be
+ *      returned in their constructed state.
+ */
+void kmem_cache_free(struct kmem_cache *cp, void *obj);
+
+#endif  /* !_VM_KMEM_H_ */
@@ -37,6 +37,8 @@
 #include <vm/mmu.h>
 #include <vm/vm.h>
 
+struct proc;
+
 /*
  * Create a virtual to physical memory mapping
  *
@@ -53,9 +55,76 @@
  */
 int vm_map(struct vm_vas *vas, struct mmu_map *spec, size_t len, int prot);
 
+/*
+ * Reserve a range of virtual memory in a process
+ * without backing it, frames are allocated as the
+ * pages are first touched.
+ *
+ * @procp: Process to reserve memory in
+ * @va: Virtual base of the range
+ * @len: Length of the range (4K aligned)
+ * @prot: Memory protection flags (PROT_*)
+ * @flags: Extra range flags (VM_RANGE_*)
+ *
+ * Returns zero on success, -EEXIST if the range is
+ * in use, otherwise a less than zero value on failure.
+ */
+int vm_reserve(struct proc *procp, vaddr_t va, size_t len, int prot, int flags);
+
+/*
+ * Unmap a range of virtual memory in a process and
+ * release whatever memory backs it, ranges that only
+ * partly overlap are cut down to size.
+ *
+ * @procp: Process to unmap memory from
+ * @va: Virtual base to unmap
+ * @len: Length to unmap (4K aligned)
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int vm_unmap(struct proc *procp, vaddr_t va, size_t len);
+
+/*
+ * Change the protection of a range of virtual memory
+ * in a process, every page must be reserved.
+ *
+ * @procp: Process to change memory of
+ * @va: Virtual base to change
+ * @len: Length to change (4K aligned)
+ * @prot: New protection flags (PROT_*)
+ *
+ * Returns zero on success, -ENOMEM if a page is not
+ * reserved, otherwise a less than zero value on failure.
+ */
+int vm_protect(struct proc *procp, vaddr_t va, size_t len, int prot);
+
+/*
+ * Give a child process a copy-on-write view of the
+ * memory of its parent, pages are shared read-only
+ * until either side writes to them.
+ *
+ * @parent: Process to copy from
+ * @child: Process to copy into (fresh address space)
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int vm_fork(struct proc *parent, struct proc *child);
+
 /*
  * POSIX mmap syscall
  */
 scret_t sys_mmap(struct syscall_args *scargs);
 
+/*
+ * POSIX munmap syscall
+ */
+scret_t sys_munmap(struct syscall_args *scargs);
+
+/*
+ * POSIX mprotect syscall
+ */
+scret_t sys_mprotect(struct syscall_args *scargs);
+
 #endif  /* !_VM_MAP_H_ */
@@ -97,6 +97,91 @@ int mmu_init(void);
  */
 int mmu_map_single(struct vm_vas *vas, struct mmu_map *spec, int prot);
 
+/*
+ * Map a single virtual page of a specific size into
+ * physical address space, larger pages are split as
+ * needed.
+ *
+ * @vas: Virtual address space to use
+ * @spec: Mapping specifier (virtual/physical address)
+ * @pgsize: Page size (see mmu_pgsize_fit())
+ * @prot: Protection flags for the mapping (see MMU_PROT_*)
+ *
+ * XXX: The addresses must be aligned to `pgsize'
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int mmu_map_page(struct vm_vas *vas, struct mmu_map *spec, size_t pgsize, int prot);
+
+/*
+ * Map a range of virtual pages into physical address
+ * space, the largest pages that fit are used.
+ *
+ * @vas: Virtual address space to use
+ * @spec: Mapping specifier (virtual/physical base)
+ * @len: Length of the range in bytes
+ * @prot: Protection flags for the mapping (see MMU_PROT_*)
+ *
+ * XXX: Nothing is left mapped if this fails
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int mmu_map_range(struct vm_vas *vas, struct mmu_map *spec, size_t len, int prot);
+
+/*
+ * Unmap a range of virtual pages, huge pages that
+ * are only partly covered are split.
+ *
+ * @vas: Virtual address space to use
+ * @va: Virtual base of the range
+ * @len: Length of the range in bytes
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int mmu_unmap_range(struct vm_vas *vas, vaddr_t va, size_t len);
+
+/*
+ * Change the protection of the pages in a range that
+ * are mapped, holes are left alone.
+ *
+ * @vas: Virtual address space to use
+ * @va: Virtual base of the range
+ * @len: Length of the range in bytes
+ * @prot: New protection flags (see MMU_PROT_*)
+ *
+ * XXX: Cache attributes of the pages are reset
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int mmu_protect_range(struct vm_vas *vas, vaddr_t va, size_t len, int prot);
+
+/*
+ * Look up the physical address that a virtual
+ * address is mapped to.
+ *
+ * @vas: Virtual address space to use
+ * @va: Virtual address to look up
+ * @pa_res: Physical address is written here
+ *
+ * Returns zero on success, -ENOENT if `va' is not
+ * mapped, otherwise a less than zero value on failure.
+ */
+int mmu_translate(struct vm_vas *vas, vaddr_t va, paddr_t *pa_res);
+
+/*
+ * Get the largest page size supported by the MMU that
+ * can be used to map part of a region.
+ *
+ * @va: Virtual address of the region
+ * @pa: Physical address of the region
+ * @len: Length of the region
+ */
+size_t mmu_pgsize_fit(vaddr_t va, paddr_t pa, size_t len);
+
 /*
  * Get a pointer to the current virtual address
  * space.
@@ -129,7 +214,11 @@ int mmu_new_vas(struct vm_vas *res);
 int mmu_write_vas(struct vm_vas *vas);
 
 /*
- * Destroy a virtual address space
+ * Destroy a virtual address space along with the
+ * page tables of its user half, the frames mapped
+ * there are left alone.
+ *
+ * XXX: No core may still be using the VAS
  *
  * @vas: VAS to destroy
  *
@@ -138,6 +227,19 @@ int mmu_write_vas(struct vm_vas *vas);
  */
 int mmu_free_vas(struct vm_vas *vas);
 
+/*
+ * Get the physical address of every page table frame
+ * that makes up the kernel VAS, the bootloader built
+ * these for us.
+ *
+ * @res: Frames are written here
+ * @max: Max number of entries in 'res'
+ *
+ * Returns the total number of frames, this may exceed
+ * 'max' in which case only 'max' entries are written.
+ */
+size_t mmu_kvas_tables(uintptr_t *res, size_t max);
+
 /*
  * Update page-level caching attributes
  *
@@ -31,6 +31,13 @@
 #define _VM_PHYSSEG_H_ 1
 
 #include <sys/types.h>
+#include <sys/param.h>
+#include <os/spinlock.h>
+#include <stdbool.h>
+
+/* Frame allocation flags */
+#define VM_ALLOC_NOZERO BIT(0)    /* Caller overwrites the frames */
+#define VM_ALLOC_TRY    BIT(1)    /* Return zero if out of memory */
 
 /*
  * Represents physical memory stats gathered
@@ -41,6 +48,35 @@ struct physmem_stat {
     size_t pages_used;
 };
 
+/*
+ * Number of frames a per-core frame cache may hold,
+ * and the number of frames moved between the cache
+ * and the global pool at once.
+ */
+#define PCACHE_SIZE  64
+#define PCACHE_BATCH (PCACHE_SIZE / 2)
+
+/*
+ * Per-core cache (magazine) of free single frames that
+ * sits in front of the global frame pool. Accesses are
+ * made from the owning core with interrupts masked, the
+ * lock is only ever contended when another core runs
+ * out of memory and empties the cache.
+ *
+ * @frames: Stack of cached frames
+ * @count: Number of frames in cache
+ * @hits: Allocations served from the cache
+ * @misses: Allocations that had to refill the cache
+ * @lock: Protects the frames
+ */
+struct vm_pcache {
+    uintptr_t frames[PCACHE_SIZE];
+    size_t count;
+    size_t hits;
+    size_t misses;
+    struct spinlock lock;
+};
+
 /*
  * Initialize physical memory and get initial physical
  * memory stats.
@@ -52,16 +88,52 @@ struct physmem_stat {
  */
 int vm_seg_init(struct physmem_stat *stat);
 
+/*
+ * Hand memory that was in use by the bootloader or
+ * that held ACPI tables over to the frame allocator.
+ *
+ * @stat: Stats are updated here
+ * @keep: Frames within those ranges that are still in use
+ * @nkeep: Number of entries in 'keep'
+ *
+ * XXX: Nothing may reference bootloader memory past
+ *      this call, 'keep' is sorted in place.
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int vm_seg_reclaim(struct physmem_stat *stat, uintptr_t *keep, size_t nkeep);
+
 /*
  * Allocate one or more physical frames and
  * get the [physical] address.
  *
  * @count: Number of frames to allocate
  *
- * Returns zero on failure (e.g., out of memory)
+ * XXX: Allocations with a power of two count are
+ *      naturally aligned to their size.
+ *
+ * XXX: Panics if out of memory, see VM_ALLOC_TRY
+ *
+ * Returns the physical address of the first frame
  */
 uintptr_t vm_alloc_frame(size_t count);
 
+/*
+ * Allocate one or more physical frames with
+ * allocation flags.
+ *
+ * @count: Number of frames to allocate
+ * @flags: Allocation flags (VM_ALLOC_*)
+ *
+ * XXX: Frames are zeroed unless VM_ALLOC_NOZERO is
+ *      set, in which case their contents are undefined.
+ *
+ * Returns zero if out of memory and VM_ALLOC_TRY is set,
+ * running out of memory without it is a panic.
+ */
+uintptr_t vm_alloc_frame_flags(size_t count, int flags);
+
 /*
  * Free one or more physical frames
  *
@@ -70,4 +142,51 @@ uintptr_t vm_alloc_frame(size_t count);
  */
 void vm_free_frame(uintptr_t base, size_t count);
 
+/*
+ * Take another reference to a frame that is mapped
+ * in more than one place, a freshly allocated frame
+ * has a single implicit reference.
+ *
+ * @pa: Physical address of the frame
+ */
+void vm_frame_ref(uintptr_t pa);
+
+/*
+ * Drop a reference to a frame, the frame is freed
+ * once the last one goes away.
+ *
+ * @pa: Physical address of the frame
+ */
+void vm_frame_unref(uintptr_t pa);
+
+/*
+ * Check if a frame has more than one reference
+ *
+ * @pa: Physical address of the frame
+ */
+bool vm_frame_shared(uintptr_t pa);
+
+/*
+ * Get the number of free blocks of a specific order
+ * (i.e., blocks of 2^order frames)
+ *
+ * @order: Block order to query
+ */
+size_t vm_seg_nfree(uint8_t order);
+
+/*
+ * Zero a free frame and put it in the pre-zeroed
+ * frame pool, meant to be called by idle cores.
+ *
+ * Returns zero if a frame was zeroed, otherwise a
+ * less than zero value if the pool is full.
+ */
+int vm_zero_idle(void);
+
+/*
+ * Measure frame allocator latency on a fragmented
+ * heap and log the results.
+ */
+void vm_bench_frames(void);
+
 #endif  /* !_VM_PHYSSEG_H_ */
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _VM_RANGE_H_
+#define _VM_RANGE_H_ 1
+
+#include <sys/types.h>
+#include <vm/vm.h>
+
+/*
+ * Allocate a zeroed range descriptor
+ *
+ * Returns NULL if we are out of memory
+ */
+struct vm_range *vm_range_alloc(void);
+
+/*
+ * Release a range descriptor
+ *
+ * @range: Range to free (must be out of any tree)
+ */
+void vm_range_free(struct vm_range *range);
+
+/*
+ * Insert a range into a range tree
+ *
+ * @tree: Tree to insert into
+ * @range: Range to insert
+ *
+ * Returns zero on success, otherwise -EEXIST if it
+ * overlaps a range already in the tree.
+ */
+int vm_range_insert(struct vm_range_tree *tree, struct vm_range *range);
+
+/*
+ * Remove a range from a range tree
+ *
+ * @tree: Tree to remove from
+ * @range: Range to remove
+ */
+void vm_range_remove(struct vm_range_tree *tree, struct vm_range *range);
+
+/*
+ * Look up the first range that ends past an address,
+ * this is either the range containing it or the next
+ * one up.
+ *
+ * @tree: Tree to search
+ * @va: Virtual address to look up
+ *
+ * Returns NULL if every range ends at or before `va'
+ */
+struct vm_range *vm_range_lookup(struct vm_range_tree *tree, vaddr_t va);
+
+/*
+ * Find the range that contains an address
+ *
+ * @tree: Tree to search
+ * @va: Virtual address to look up
+ *
+ * Returns NULL if no range contains `va'
+ */
+struct vm_range *vm_range_find(struct vm_range_tree *tree, vaddr_t va);
+
+/*
+ * Update the tree after the bounds of a range were
+ * changed in place, the range must keep its place
+ * in the order.
+ *
+ * @range: Range that was changed
+ */
+void vm_range_fixup(struct vm_range *range);
+
+/*
+ * Find a free hole for a new range, holes at or
+ * above `hint' are tried before wrapping around to
+ * the bottom of the window.
+ *
+ * @tree: Tree to search
+ * @len: Length needed (4K aligned)
+ * @lo: Lowest usable address
+ * @hi: End of the usable window
+ * @hint: Address to start looking from
+ *
+ * Returns the base of the hole, otherwise zero if
+ * there is no room.
+ */
+vaddr_t vm_range_fit(struct vm_range_tree *tree, size_t len, vaddr_t lo,
+    vaddr_t hi, vaddr_t hint);
+
+#endif  /* !_VM_RANGE_H_ */
@@ -32,6 +32,7 @@
 
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <sys/tree.h>
 #include <sys/param.h>
 #include <sys/bootvars.h>
 
@@ -46,21 +47,44 @@
 typedef uintptr_t vaddr_t;
 typedef uintptr_t paddr_t;
 
+/* Range flags */
+#define VM_RANGE_OWNED  BIT(0)  /* Frames at pa_base belong to the range */
+#define VM_RANGE_LAZY   BIT(1)  /* Frames are allocated on first touch */
+#define VM_RANGE_STACK  BIT(2)  /* Grows down on demand */
+
 /*
  * Describes a virtual memory range
  *
- * @pa_base: Physical memory base
+ * @pa_base: Physical memory base (if not lazy)
  * @va_base: Virtual memory base
  * @len: Length of region
- * @link: Queue link
+ * @prot: Protection flags (PROT_*)
+ * @flags: Range flags (VM_RANGE_*)
+ * @sub_start: Lowest address covered by this subtree
+ * @sub_end: Highest end address covered by this subtree
+ * @sub_gap: Largest hole between ranges of this subtree
+ * @tree: Range tree link
  */
 struct vm_range {
     paddr_t pa_base;
     vaddr_t va_base;
     size_t len;
-    TAILQ_ENTRY(vm_range) link;
+    int prot;
+    uint8_t flags;
+    vaddr_t sub_start;
+    vaddr_t sub_end;
+    size_t sub_gap;
+    RB_ENTRY(vm_range) tree;
 };
 
+/*
+ * Ranges of a process, sorted by their virtual
+ * base and never overlapping.
+ */
+RB_HEAD(vm_range_tree, vm_range);
+int vm_range_cmp(struct vm_range *a, struct vm_range *b);
+RB_PROTOTYPE(vm_range_tree, vm_range, tree, vm_range_cmp)
+
 void vm_init(void);
 
 #endif  /* !_VM_H_ */
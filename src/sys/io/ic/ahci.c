@@ -254,7 +254,7 @@ ahci_identify(struct ahci_hba *hba, struct ahci_port *port)
     paddr_t buf, cmdbase;
     int cmdslot, status;
 
-    buf = vm_alloc_frame(1);
+    buf = vm_alloc_frame_flags(1, VM_ALLOC_NOZERO);
     if (buf == 0) {
         pr_trace("identify: failed to allocate frame\n");
         return -ENOMEM;
@@ -321,7 +321,7 @@ ahci_rw(struct ahci_hba *hba, struct ahci_port *port, struct bufargs *bufd)
     npgs = ALIGN_UP((bufd->nblocks * bsize), DEFAULT_PAGESIZE);
     npgs /= DEFAULT_PAGESIZE;
 
-    buf = vm_alloc_frame(npgs);
+    buf = vm_alloc_frame_flags(npgs, VM_ALLOC_NOZERO);
     if (buf == 0) {
         pr_trace("identify: failed to allocate frame\n");
         return -ENOMEM;
@@ -84,6 +84,13 @@ fbdev_map(struct mac_border *mbp, struct mac_map_args *args)
         return error;
     }
 
+    /* Track it but leave the framebuffer be on exit */
+    if (self != NULL) {
+        spinlock_acquire(&self->maplist_lock);
+        proc_add_range(self, spec.va, spec.pa, args->len, prot, 0);
+        spinlock_release(&self->maplist_lock);
+    }
+
     *args->dp_res = (void *)VIRT_TO_PHYS(fbvar->io);
     return args->len;
 }
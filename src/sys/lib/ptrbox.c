@@ -31,8 +31,15 @@
 #include <sys/syslog.h>
 #include <os/kalloc.h>
 #include <lib/ptrbox.h>
+#include <vm/kmem.h>
 #include <string.h>
 
+static struct kmem_cache ent_cache = KMEM_CACHE_INIT(
+    "ptrbox_entry",
+    sizeof(struct ptrbox_entry),
+    NULL
+);
+
 /*
  * Allocate memory and add it to an existing
  * box
@@ -46,7 +53,7 @@ ptrbox_alloc(size_t len, struct ptrbox *box)
         return NULL;
     }
 
-    ent = kalloc(sizeof(*ent));
+    ent = kmem_cache_alloc(&ent_cache);
     if (ent == NULL) {
         return NULL;
     }
@@ -54,7 +61,7 @@ ptrbox_alloc(size_t len, struct ptrbox *box)
     /* Allocate the actual data */
     ent->data = kalloc(len);
     if (ent->data == NULL) {
-        kfree(ent);
+        kmem_cache_free(&ent_cache, ent);
         return NULL;
     }
 
@@ -79,17 +86,14 @@ ptrbox_terminate(struct ptrbox *box)
      * Go through each entry first, reap one
      * by one.
      */
-    TAILQ_FOREACH(ent, &box->q, link) {
-        if (ent == NULL) {
-            continue;
-        }
-
+    while ((ent = TAILQ_FIRST(&box->q)) != NULL) {
+        TAILQ_REMOVE(&box->q, ent, link);
         kfree(ent->data);
-        ent->data = NULL;
+        kmem_cache_free(&ent_cache, ent);
     }
 
     /* Reap ourselves */
-    kfree(ent);
+    kfree(box);
     return 0;
 }
 
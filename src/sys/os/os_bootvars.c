@@ -39,6 +39,28 @@
 
 #define FRAMEBUFFER framebuffer_req.response->framebuffers[0]
 
+/* Max number of modules we keep track of */
+#define MODULE_MAX      16
+#define MODULE_PATH_MAX 128
+
+/*
+ * A bootloader module, the bootloader keeps its own
+ * list in memory that is reclaimed later on so we copy
+ * what we need.
+ *
+ * @path: Path of the module
+ * @address: Module data
+ * @size: Size of module data
+ */
+struct boot_module {
+    char path[MODULE_PATH_MAX];
+    char *address;
+    uint64_t size;
+};
+
+static struct boot_module modtab[MODULE_MAX];
+static size_t nmod = 0;
+
 static off_t __hhdm_offset = 0;
 static volatile struct limine_hhdm_request hhdm_req = {
     .id = LIMINE_HHDM_REQUEST,
@@ -70,16 +92,46 @@ static volatile struct limine_rsdp_request rsdp_req = {
  */
 static char *
 get_module(const char *path, uint64_t *size) {
-    for (uint64_t i = 0; i < mod_req.response->module_count; ++i) {
-        if (strcmp(mod_req.response->modules[i]->path, path) == 0) {
-            *size = mod_req.response->modules[i]->size;
-            return mod_req.response->modules[i]->address;
+    for (size_t i = 0; i < nmod; ++i) {
+        if (strcmp(modtab[i].path, path) == 0) {
+            *size = modtab[i].size;
+            return modtab[i].address;
         }
     }
 
     return NULL;
 }
 
+/*
+ * Copy the module list from the bootloader
+ */
+static void
+read_modules(void)
+{
+    struct limine_module_response *resp = mod_req.response;
+    struct limine_file *file;
+    struct boot_module *mod;
+
+    if (resp == NULL) {
+        return;
+    }
+
+    for (uint64_t i = 0; i < resp->module_count; ++i) {
+        file = resp->modules[i];
+        if (nmod >= MODULE_MAX) {
+            panic("bootvars: too many modules\n");
+        }
+        if (strlen(file->path) >= MODULE_PATH_MAX) {
+            panic("bootvars: module path too long\n");
+        }
+
+        mod = &modtab[nmod++];
+        memcpy(mod->path, file->path, strlen(file->path) + 1);
+        mod->address = file->address;
+        mod->size = file->size;
+    }
+}
+
 static void
 read_fbvars(struct bootvar_fb *fbvars)
 {
@@ -128,6 +180,9 @@ get_kernel_base(void)
  *
  * XXX: BV_BYPASS_CACHE calls are still cached however entries are
  *      guaranteed to not be stale.
+ *
+ * XXX: The bootloader responses are only read on the first call,
+ *      the memory holding them is reclaimed later on.
  */
 int
 bootvars_read(struct bootvars *bvp, int flags)
@@ -141,10 +196,11 @@ bootvars_read(struct bootvars *bvp, int flags)
     }
 
     /*
-     * If BV_BYPASS_CACHE is not set and we have a cache
-     * entry, use it.
+     * Nothing the bootloader gave us changes after boot,
+     * so a cached entry is never stale even if the caller
+     * asked us to bypass the cache.
      */
-    if (cached && !ISSET(flags, BV_BYPASS_CACHE)) {
+    if (cached) {
         *bvp = cache;
         return 0;
     }
@@ -152,6 +208,7 @@ bootvars_read(struct bootvars *bvp, int flags)
     cache.magic = BOOTVARS_MAGIC;
     read_fbvars(&cache.fbvars);
     read_iovars(&cache.iovars);
+    read_modules();
 
     /* We need this for proper operation */
     if ((rsdp_resp = rsdp_req.response) == NULL) {
@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Description: Per-core timer wheels
+ * Author: Ian Marco Moffett
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/errno.h>
+#include <sys/queue.h>
+#include <sys/cpuvar.h>
+#include <os/clkdev.h>
+#include <os/callout.h>
+#include <os/sched.h>
+#include <stdbool.h>
+
+#define CALLOUT_SLOT(usec) \
+    (((usec) / CALLOUT_TICK_USEC) % CALLOUT_NSLOT)
+
+static struct clkdev *clk = NULL;
+
+/*
+ * Put a callout in its slot
+ *
+ * @wheel: Wheel to use
+ * @cop: Callout to insert
+ *
+ * Returns true if it is now the earliest callout
+ *
+ * XXX: Wheel lock must be held
+ */
+static bool
+callout_insert(struct callout_wheel *wheel, struct callout *cop)
+{
+    bool first;
+
+    TAILQ_INSERT_TAIL(&wheel->slot[CALLOUT_SLOT(cop->expire)], cop, link);
+    cop->wheel = wheel;
+
+    first = (wheel->npending++ == 0 || cop->expire < wheel->next);
+    if (first) {
+        wheel->next = cop->expire;
+    }
+
+    return first;
+}
+
+/*
+ * Take a callout off of its wheel
+ *
+ * @cop: Callout to remove
+ *
+ * XXX: Wheel lock must be held, the earliest expiry is
+ *      left as is and may just go off early.
+ */
+static void
+callout_remove(struct callout *cop)
+{
+    struct callout_wheel *wheel = cop->wheel;
+
+    cop->wheel = NULL;
+    if (cop->due) {
+        TAILQ_REMOVE(&wheel->expired, cop, link);
+        cop->due = false;
+        return;
+    }
+
+    TAILQ_REMOVE(&wheel->slot[CALLOUT_SLOT(cop->expire)], cop, link);
+    --wheel->npending;
+}
+
+/*
+ * Find the earliest expiry of anything on a wheel
+ *
+ * @wheel: Wheel to scan
+ *
+ * XXX: Wheel lock must be held
+ */
+static void
+callout_find_next(struct callout_wheel *wheel)
+{
+    struct callout *cop;
+
+    wheel->next = __UINT64_MAX;
+    if (wheel->npending == 0) {
+        return;
+    }
+
+    for (int i = 0; i < CALLOUT_NSLOT; ++i) {
+        TAILQ_FOREACH(cop, &wheel->slot[i], link) {
+            wheel->next = MIN(wheel->next, cop->expire);
+        }
+    }
+}
+
+/*
+ * Get the time since boot
+ */
+size_t
+callout_time(void)
+{
+    if (clk == NULL) {
+        clkdev_get(CLKDEV_MSLEEP | CLKDEV_GET_USEC, &clk);
+    }
+    if (__unlikely(clk == NULL)) {
+        return 0;
+    }
+
+    return clk->get_time_usec();
+}
+
+/*
+ * Arm a callout
+ */
+int
+callout_reset(struct callout *cop, size_t usec, void(*fn)(void *), void *arg)
+{
+    struct callout_wheel *wheel;
+    struct pcore *core;
+    size_t now;
+    uint64_t intr;
+    bool first;
+
+    if (cop == NULL || fn == NULL) {
+        return -EINVAL;
+    }
+
+    if ((now = callout_time()) == 0) {
+        return -ENODEV;
+    }
+
+    /* Take it off of wherever it was */
+    callout_stop(cop);
+
+    intr = md_intr_save();
+    if ((core = this_core()) == NULL) {
+        md_intr_restore(intr);
+        return -ENXIO;
+    }
+
+    wheel = &core->wheel;
+    cop->fn = fn;
+    cop->arg = arg;
+    cop->expire = now + MAX(usec, 1);
+
+    spinlock_acquire(&wheel->lock);
+    first = callout_insert(wheel, cop);
+    spinlock_release(&wheel->lock);
+
+    /*
+     * Our timer may be stopped or armed for later than
+     * this, have the scheduler pick it up.
+     */
+    if (first) {
+        sched_kick(core);
+    }
+
+    md_intr_restore(intr);
+    return 0;
+}
+
+/*
+ * Disarm a callout
+ */
+int
+callout_stop(struct callout *cop)
+{
+    struct callout_wheel *wheel;
+    uint64_t intr;
+    int error = -ESRCH;
+
+    if (cop == NULL) {
+        return -EINVAL;
+    }
+
+    if ((wheel = cop->wheel) == NULL) {
+        return -ESRCH;
+    }
+
+    /* It may have fired while we took the lock */
+    intr = md_intr_save();
+    spinlock_acquire(&wheel->lock);
+    if (cop->wheel == wheel) {
+        callout_remove(cop);
+        error = 0;
+    }
+
+    spinlock_release(&wheel->lock);
+    md_intr_restore(intr);
+    return error;
+}
+
+/*
+ * Fire expired callouts
+ */
+size_t
+callout_run(struct pcore *core)
+{
+    struct callout_wheel *wheel;
+    struct callout *cop, *tmp;
+    void(*fn)(void *);
+    void *arg;
+    size_t now, now_tick, nslots;
+    size_t nfired = 0;
+
+    if (core == NULL) {
+        return 0;
+    }
+
+    /* Nothing is due, don't bother with the clock */
+    wheel = &core->wheel;
+    if (wheel->npending == 0) {
+        return 0;
+    }
+
+    now = callout_time();
+    if (now < wheel->next) {
+        return 0;
+    }
+
+    spinlock_acquire(&wheel->lock);
+
+    /*
+     * Go through every slot since the last tick we have
+     * processed, anything there that is due gets moved
+     * off to be fired. They stay on the wheel until then
+     * so they can still be stopped or moved.
+     */
+    now_tick = now / CALLOUT_TICK_USEC;
+    nslots = MIN((now_tick - wheel->tick) + 1, CALLOUT_NSLOT);
+    for (size_t i = 0; i < nslots; ++i) {
+        tmp = TAILQ_FIRST(&wheel->slot[(wheel->tick + i) % CALLOUT_NSLOT]);
+        while ((cop = tmp) != NULL) {
+            tmp = TAILQ_NEXT(cop, link);
+            if (cop->expire > now)
+                continue;
+
+            callout_remove(cop);
+            TAILQ_INSERT_TAIL(&wheel->expired, cop, link);
+            cop->wheel = wheel;
+            cop->due = true;
+        }
+    }
+
+    wheel->tick = now_tick;
+    callout_find_next(wheel);
+
+    /* Callouts may re-arm themselves, keep the lock dropped */
+    while ((cop = TAILQ_FIRST(&wheel->expired)) != NULL) {
+        callout_remove(cop);
+        fn = cop->fn;
+        arg = cop->arg;
+        spinlock_release(&wheel->lock);
+
+        fn(arg);
+        ++nfired;
+        spinlock_acquire(&wheel->lock);
+    }
+
+    spinlock_release(&wheel->lock);
+    return nfired;
+}
+
+/*
+ * Get the time until the next callout
+ */
+size_t
+callout_next_event(struct pcore *core)
+{
+    struct callout_wheel *wheel;
+    size_t now;
+
+    if (core == NULL) {
+        return 0;
+    }
+
+    wheel = &core->wheel;
+    if (wheel->npending == 0) {
+        return 0;
+    }
+
+    /* Already due, come back as soon as we can */
+    now = callout_time();
+    if (now >= wheel->next) {
+        return 1;
+    }
+
+    return wheel->next - now;
+}
+
+/*
+ * Initialize a timer wheel
+ */
+void
+callout_wheel_init(struct callout_wheel *wheel)
+{
+    for (int i = 0; i < CALLOUT_NSLOT; ++i) {
+        TAILQ_INIT(&wheel->slot[i]);
+    }
+
+    TAILQ_INIT(&wheel->expired);
+    wheel->lock.lock = 0;
+    wheel->tick = 0;
+    wheel->next = __UINT64_MAX;
+    wheel->npending = 0;
+}
@@ -66,7 +66,7 @@ clkdev_get(uint16_t attr, struct clkdev **clkdev_res)
     }
 
     /* Must find one that matches 'attr' */
-    for (int i = 0; i < MAX_CLKDEV; ++i) {
+    for (int i = 0; i < nclk; ++i) {
         if (clklist[i]->attr == attr) {
             *clkdev_res = clklist[i];
             return 0;
@@ -84,12 +84,95 @@ elf64_verify(Elf64_Ehdr *eh)
     return 0;
 }
 
+/*
+ * Map pages of the initrd image straight into a
+ * process, these are shared by every process that
+ * runs the same binary and are never freed.
+ *
+ * @proc: Process to map pages into
+ * @va: Page aligned virtual address
+ * @src: Page aligned source within the image
+ * @len: Length to map in bytes
+ * @prot: Protection flags
+ */
+static int
+elf64_map_image(struct proc *proc, vaddr_t va, void *src, size_t len, int prot)
+{
+    struct mmu_map spec;
+    int error;
+
+    spec.va = va;
+    spec.pa = VIRT_TO_PHYS(src);
+    error = vm_map(&proc->pcb.vas, &spec, len, prot);
+    if (error < 0) {
+        printf("elf64_map_image: failed to map segment\n");
+        return error;
+    }
+
+    spinlock_acquire(&proc->maplist_lock);
+    error = proc_add_range(proc, va, spec.pa, len, prot, 0);
+    spinlock_release(&proc->maplist_lock);
+    return error;
+}
+
+/*
+ * Copy part of a segment into fresh frames
+ *
+ * @proc: Process to map pages into
+ * @va: Page aligned virtual address
+ * @len: Length to map in bytes
+ * @src: Segment data to copy
+ * @off: Offset of the data from 'va'
+ * @filesz: Number of bytes to copy from 'src'
+ * @prot: Protection flags
+ */
+static int
+elf64_map_copy(struct proc *proc, vaddr_t va, size_t len, const void *src,
+    size_t off, size_t filesz, int prot)
+{
+    static const size_t PSIZE = DEFAULT_PAGESIZE;
+    struct mmu_map spec;
+    size_t npgs;
+    void *dest;
+    int error;
+
+    npgs = len / PSIZE;
+    spec.va = va;
+    spec.pa = vm_alloc_frame_flags(npgs, VM_ALLOC_NOZERO | VM_ALLOC_TRY);
+    if (spec.pa == 0) {
+        printf("elf64_map_copy: could not alloc frame\n");
+        return -ENOMEM;
+    }
+
+    /* Copy the segment data and zero the rest */
+    dest = PHYS_TO_VIRT(spec.pa);
+    memset(dest, 0, off);
+    memcpy(PTR_OFFSET(dest, off), src, filesz);
+    memset(PTR_OFFSET(dest, off + filesz), 0, len - (off + filesz));
+
+    error = vm_map(&proc->pcb.vas, &spec, len, prot);
+    if (error < 0) {
+        printf("elf64_map_copy: failed to map segment\n");
+        vm_free_frame(spec.pa, npgs);
+        return error;
+    }
+
+    spinlock_acquire(&proc->maplist_lock);
+    error = proc_add_range(proc, va, spec.pa, len, prot, VM_RANGE_OWNED);
+    spinlock_release(&proc->maplist_lock);
+    return error;
+}
+
 /*
  * Do the actual ELF64 loading
  *
  * @eh: ELF header to load
  * @p: Process to load program as
  *
+ * Read-only segments whose file data lines up with their
+ * virtual address are mapped in place from the image, only
+ * writable segments and partial tail pages get copied.
+ *
  * Returns zero on success, otherwise a less
  * than zero value on failure.
  *
@@ -99,19 +182,16 @@ static int
 elf64_do_load(Elf64_Ehdr *eh, struct proc *proc)
 {
     static const size_t PSIZE = DEFAULT_PAGESIZE;
-    struct md_pcb *pcbp;
-    struct mmu_map spec;
     Elf64_Phdr *phdr, *phdr_base;
-    paddr_t frame;
-    size_t npgs, len, misalign;
-    void *tmp;
+    vaddr_t va;
+    size_t len, off, shared, copy_off;
+    char *src;
     int error, prot;
 
     if (eh == NULL || proc == NULL) {
         return -EINVAL;
     }
 
-    pcbp = &proc->pcb;
 #define PHDR_I(PHDR_BASE, INDEX) \
     PTR_OFFSET(PHDR_BASE, eh->e_phentsize*(INDEX))
     phdr_base = PTR_OFFSET(eh, eh->e_phoff);
@@ -130,39 +210,50 @@ elf64_do_load(Elf64_Ehdr *eh, struct proc *proc)
             if (phdr->p_memsz == 0 && phdr->p_filesz == 0) {
                 continue;
             }
+            if (phdr->p_filesz > phdr->p_memsz) {
+                return -ENOEXEC;
+            }
 
-            /* Re-align the length */
-            misalign = phdr->p_memsz & (PSIZE - 1);
-            len = phdr->p_memsz;
-            len = ALIGN_UP(len + misalign, PSIZE);
-            npgs = len / PSIZE;
+            /* Work in whole pages from here on */
+            off = phdr->p_vaddr & (PSIZE - 1);
+            va = phdr->p_vaddr - off;
+            len = ALIGN_UP(off + phdr->p_memsz, PSIZE);
+            src = PTR_OFFSET(eh, phdr->p_offset);
+
+            /*
+             * Pages that are entirely backed by the file can be
+             * shared if nobody may write to them and the image
+             * data sits on the same page offset.
+             */
+            shared = 0;
+            if (!ISSET(prot, PROT_WRITE) &&
+                ((uintptr_t)src & (PSIZE - 1)) == off) {
+                shared = ALIGN_DOWN(off + phdr->p_filesz, PSIZE);
+            }
 
-            if (npgs == 0) {
-                ++npgs;
+            if (shared > 0) {
+                error = elf64_map_image(proc, va, src - off, shared, prot);
+                if (error < 0) {
+                    return error;
+                }
             }
 
-            frame = vm_alloc_frame(npgs);
-            if (frame == 0) {
-                printf("elf64_do_load: could not alloc frame\n");
-                return -ENOMEM;
+            if (shared == len) {
+                break;
             }
 
-            /* Copy the segment data */
-            tmp = PTR_OFFSET(eh, phdr->p_offset);
-            memcpy(PHYS_TO_VIRT(frame), tmp, phdr->p_filesz);
-
-            /* Map the segment */
-            spec.va = phdr->p_vaddr;
-            spec.pa = frame;
-            error = vm_map(
-                &pcbp->vas,
-                &spec,
-                len,
+            /* Copy whatever is left (the tail or everything) */
+            copy_off = MAX(shared, off);
+            error = elf64_map_copy(
+                proc, va + shared,
+                len - shared,
+                src + (copy_off - off),
+                copy_off - shared,
+                (off + phdr->p_filesz) - copy_off,
                 prot
             );
 
             if (error < 0) {
-                printf("elf64_do_load: failed to map segment\n");
                 return error;
             }
             break;
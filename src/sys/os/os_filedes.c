@@ -38,11 +38,18 @@
 #include <os/kalloc.h>
 #include <os/systm.h>
 #include <io/cons/cons.h>
+#include <vm/kmem.h>
 #include <compat/unix/syscall.h>
 #include <string.h>
 
 #define STDOUT_FILENO 1
 
+static struct kmem_cache fd_cache = KMEM_CACHE_INIT(
+    "filedesc",
+    sizeof(struct filedesc),
+    NULL
+);
+
 /*
  * Allocate a file descriptor
  */
@@ -64,7 +71,7 @@ fd_alloc(struct proc *procp, struct filedesc **fd_res)
             continue;
         }
 
-        fd = kalloc(sizeof(*fd));
+        fd = kmem_cache_alloc(&fd_cache);
         if (fd == NULL) {
             return -EINVAL;
         }
@@ -121,7 +128,7 @@ fd_dup(struct proc *procp, int fd)
     int error;
 
     old = fd_get(procp, fd);
-    if (new == NULL) {
+    if (old == NULL) {
         return NULL;
     }
 
@@ -216,7 +223,7 @@ fd_close(int fd)
     vp = fdp->vp;
     proc->fdtab[fdp->fdno] = NULL;
 
-    kfree(fdp);
+    kmem_cache_free(&fd_cache, fdp);
     return vop_reclaim(vp, 0);
 }
 
@@ -245,6 +252,71 @@ fdtab_init(struct proc *procp)
     return 0;
 }
 
+/*
+ * Copy a file descriptor table
+ */
+int
+fdtab_copy(struct proc *dst, struct proc *src)
+{
+    struct filedesc *sfd, *dfd;
+
+    if (dst == NULL || src == NULL) {
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < FD_MAX; ++i) {
+        if ((sfd = src->fdtab[i]) == NULL) {
+            continue;
+        }
+
+        /* Reuse what fdtab_init() gave us if we can */
+        if ((dfd = dst->fdtab[i]) == NULL) {
+            dfd = kmem_cache_alloc(&fd_cache);
+            if (dfd == NULL)
+                return -ENOMEM;
+
+            dst->fdtab[i] = dfd;
+        }
+
+        if (sfd->vp != NULL) {
+            vnode_ref(sfd->vp);
+        }
+
+        dfd->fdno = i;
+        dfd->off = sfd->off;
+        dfd->vp = sfd->vp;
+        dfd->mode = sfd->mode;
+    }
+
+    return 0;
+}
+
+/*
+ * Free a file descriptor table
+ */
+void
+fdtab_free(struct proc *procp)
+{
+    struct filedesc *fdp;
+
+    if (procp == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < FD_MAX; ++i) {
+        if ((fdp = procp->fdtab[i]) == NULL) {
+            continue;
+        }
+
+        if (fdp->vp != NULL) {
+            vop_reclaim(fdp->vp, 0);
+        }
+
+        procp->fdtab[i] = NULL;
+        kmem_cache_free(&fd_cache, fdp);
+    }
+}
+
 ssize_t
 write(int fd, const void *buf, size_t count)
 {
@@ -258,8 +330,11 @@ write(int fd, const void *buf, size_t count)
         return -ESRCH;
     }
 
+    /* Anything past the bounce buffer is a short write */
+    count = MIN(count, sizeof(kbuf));
+
     /* Must be valid */
-    error = proc_check_addr(proc_self(), (uintptr_t)buf, count);
+    error = proc_check_addr(self, (uintptr_t)buf, count, PROT_READ);
     if (error < 0) {
         return error;
     }
@@ -316,7 +391,7 @@ read(int fd, void *buf, size_t count)
     }
 
     /* Must be valid */
-    error = proc_check_addr(self, (uintptr_t)buf, count);
+    error = proc_check_addr(self, (uintptr_t)buf, count, PROT_WRITE);
     if (error < 0) {
         return error;
     }
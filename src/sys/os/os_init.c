@@ -34,6 +34,7 @@
 #include <sys/proc.h>
 #include <sys/cpuvar.h>
 #include <os/sched.h>
+#include <os/workq.h>
 #include <os/elfload.h>
 #include <os/vfs.h>
 #include <os/nsvar.h>
@@ -78,6 +79,7 @@ main(void)
 
     sched_init();
     bsp_ap_startup();
+    workq_init();
 
     /* Initialize generic modules */
     __MODULES_INIT(MODTYPE_GENERIC);
@@ -36,13 +36,27 @@
 #include <os/systm.h>
 #include <os/kalloc.h>
 #include <os/iotap.h>
+#include <os/sched.h>
 #include <os/nsvar.h>
 #include <os/ns.h>
+#include <vm/kmem.h>
 #include <stdbool.h>
 #include <string.h>
 
 static size_t next_id = 0;
 
+static struct kmem_cache tap_cache = KMEM_CACHE_INIT(
+    "iotap",
+    sizeof(struct iotap_desc),
+    NULL
+);
+
+static struct kmem_cache obj_cache = KMEM_CACHE_INIT(
+    "iotap_obj",
+    sizeof(struct ns_obj),
+    NULL
+);
+
 iotap_t
 iotap_register(const struct iotap_desc *iotap)
 {
@@ -54,14 +68,14 @@ iotap_register(const struct iotap_desc *iotap)
         return -EINVAL;
     }
 
-    tap = kalloc(sizeof(*tap));
+    tap = kmem_cache_alloc(&tap_cache);
     if (tap == NULL) {
         return -EINVAL;
     }
 
-    obj = kalloc(sizeof(*obj));
+    obj = kmem_cache_alloc(&obj_cache);
     if (obj == NULL) {
-        kfree(tap);
+        kmem_cache_free(&tap_cache, tap);
         return -EINVAL;
     }
 
@@ -77,8 +91,8 @@ iotap_register(const struct iotap_desc *iotap)
     error = ns_obj_enter(NS_IOTAP, obj, iotap->name);
 
     if (error < 0) {
-        kfree(tap);
-        kfree(obj);
+        kmem_cache_free(&tap_cache, tap);
+        kmem_cache_free(&obj_cache, obj);
         return error;
     }
 
@@ -203,6 +217,11 @@ sys_muxtap(struct syscall_args *scargs)
         copyout(kbuf, u_databuf, msg.len);
     }
 
+    /* Readers waiting on input should get it quickly */
+    if (error > 0 && msg.opcode == IOTAP_OPC_READ) {
+        sched_boost(proc_self());
+    }
+
     kfree(kbuf);
     return error;
 }
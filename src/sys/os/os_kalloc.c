@@ -28,50 +28,229 @@
  */
 
 #include <sys/panic.h>
+#include <sys/param.h>
+#include <sys/atomic.h>
+#include <sys/limits.h>
+#include <sys/syslog.h>
+#include <sys/cpuvar.h>
 #include <os/kalloc.h>
 #include <os/spinlock.h>
 #include <vm/tlsf.h>
 #include <vm/physseg.h>
 #include <vm/vm.h>
+#include <string.h>
 #include <stdbool.h>
 
-#define KALLOC_POOL_PAGES     (KALLOC_POOL_SZ / DEFAULT_PAGESIZE)
-#define KALLOC_POOL_SZ        0x400000  /* 4 MiB */
+/*
+ * Each arena starts with a pool of KALLOC_POOL_SZ bytes
+ * and grows by at least that much when it runs dry.
+ */
+#define KALLOC_POOL_SZ        0x100000  /* 1 MiB */
+
+/* Largest allocation we will grow an arena for */
+#define KALLOC_MAX            0x4000000 /* 64 MiB */
+
+/* Marks a live allocation */
+#define KALLOC_MAGIC          0x4B414C43 /* 'KALC' */
 
 void __kalloc_init(void);
 
-static struct spinlock lock;
-static tlsf_t tlsf_ctx;
-static paddr_t pool = 0;
-static void *pool_va = 0;
+/*
+ * Header placed before every allocation so it can
+ * be given back to the arena that owns it.
+ *
+ * @arena: Index of the owning arena
+ * @magic: KALLOC_MAGIC while allocated
+ * @next: Remote free queue link
+ */
+struct kalloc_hdr {
+    uint32_t arena;
+    uint32_t magic;
+    struct kalloc_hdr *next;
+};
+
+/*
+ * A per-core allocation arena, chunks freed by other
+ * cores are pushed onto the remote queue without
+ * taking the lock and are reclaimed by the owner.
+ *
+ * @tlsf: TLSF context for this arena
+ * @remote: Remote free queue
+ * @lock: Protects the TLSF context
+ * @npools: Number of pools in this arena
+ */
+struct kalloc_arena {
+    tlsf_t tlsf;
+    struct kalloc_hdr *volatile remote;
+    struct spinlock lock;
+    size_t npools;
+} __aligned(COHERENCY_UNIT);
+
+static struct kalloc_arena arenas[CPU_MAX];
 static bool is_init = false;
 
+/*
+ * Get the arena of the current core, cores that are
+ * not set up yet share the first arena.
+ *
+ * @idx_res: Index of the arena is written here
+ *
+ * XXX: Interrupts must be masked
+ */
+static struct kalloc_arena *
+kalloc_arena_get(uint32_t *idx_res)
+{
+    struct pcore *core;
+    uint32_t idx = 0;
+
+    if ((core = this_core()) != NULL) {
+        idx = core->id;
+    }
+
+    *idx_res = idx;
+    return &arenas[idx];
+}
+
+/*
+ * Grow an arena by adding a new pool to it, the
+ * arena is created if it does not exist yet.
+ *
+ * @ap: Arena to grow
+ * @sz: Size of the allocation that needs to fit
+ *
+ * XXX: Arena lock must be held
+ *
+ * Returns zero on success
+ */
+static int
+kalloc_arena_grow(struct kalloc_arena *ap, size_t sz)
+{
+    size_t len;
+    paddr_t pa;
+    void *va;
+
+    len = sz + tlsf_pool_overhead() + tlsf_alloc_overhead();
+    len = MAX(ALIGN_UP(len, DEFAULT_PAGESIZE), KALLOC_POOL_SZ);
+
+    /* Running out of frames is a NULL return, not a panic */
+    pa = vm_alloc_frame_flags(
+        len / DEFAULT_PAGESIZE,
+        VM_ALLOC_NOZERO | VM_ALLOC_TRY
+    );
+    if (pa == 0) {
+        return -1;
+    }
+
+    va = PHYS_TO_VIRT(pa);
+    if (ap->tlsf == NULL) {
+        ap->tlsf = tlsf_create_with_pool(va, len);
+        if (ap->tlsf == NULL) {
+            vm_free_frame(pa, len / DEFAULT_PAGESIZE);
+            return -1;
+        }
+    } else if (tlsf_add_pool(ap->tlsf, va, len) == NULL) {
+        vm_free_frame(pa, len / DEFAULT_PAGESIZE);
+        return -1;
+    }
+
+    ++ap->npools;
+    return 0;
+}
+
+/*
+ * Free every chunk that other cores queued for us
+ *
+ * XXX: Arena lock must be held
+ */
+static void
+kalloc_drain(struct kalloc_arena *ap)
+{
+    struct kalloc_hdr *hdr, *next;
+
+    if (ap->remote == NULL) {
+        return;
+    }
+
+    hdr = atomic_swap_ptr(&ap->remote, NULL);
+    while (hdr != NULL) {
+        next = hdr->next;
+        tlsf_free(ap->tlsf, hdr);
+        hdr = next;
+    }
+}
+
 /*
  * Memory allocation
  */
 void *
 kalloc(size_t sz)
 {
-    void *tmp;
+    struct kalloc_arena *ap;
+    struct kalloc_hdr *hdr = NULL;
+    uint32_t idx;
+    uint64_t intr;
 
-    if (!is_init) {
+    if (!is_init || sz > KALLOC_MAX) {
         return NULL;
     }
 
-    spinlock_acquire(&lock);
-    tmp = tlsf_malloc(tlsf_ctx, sz);
-    spinlock_release(&lock);
-    return tmp;
+    sz += sizeof(*hdr);
+    intr = md_intr_save();
+    ap = kalloc_arena_get(&idx);
+    spinlock_acquire(&ap->lock);
+
+    /* Create the arena on first use */
+    if (ap->tlsf == NULL && kalloc_arena_grow(ap, 0) < 0) {
+        goto done;
+    }
+
+    kalloc_drain(ap);
+    hdr = tlsf_malloc(ap->tlsf, sz);
+    if (hdr == NULL && kalloc_arena_grow(ap, sz) == 0) {
+        hdr = tlsf_malloc(ap->tlsf, sz);
+    }
+done:
+    spinlock_release(&ap->lock);
+    md_intr_restore(intr);
+    if (hdr == NULL) {
+        return NULL;
+    }
+
+    hdr->arena = idx;
+    hdr->magic = KALLOC_MAGIC;
+    hdr->next = NULL;
+    return hdr + 1;
 }
 
 void *
 krealloc(void *old_ptr, size_t newsize)
 {
+    struct kalloc_hdr *hdr;
+    size_t oldsize;
     void *tmp;
 
-    spinlock_acquire(&lock);
-    tmp = tlsf_realloc(tlsf_ctx, old_ptr, newsize);
-    spinlock_release(&lock);
+    if (old_ptr == NULL) {
+        return kalloc(newsize);
+    }
+
+    hdr = (struct kalloc_hdr *)old_ptr - 1;
+    if (hdr->magic != KALLOC_MAGIC) {
+        printf("krealloc: bad pointer %p\n", old_ptr);
+        return NULL;
+    }
+
+    /* Still fits? */
+    oldsize = tlsf_block_size(hdr) - sizeof(*hdr);
+    if (newsize <= oldsize) {
+        return old_ptr;
+    }
+
+    if ((tmp = kalloc(newsize)) == NULL) {
+        return NULL;
+    }
+
+    memcpy(tmp, old_ptr, oldsize);
+    kfree(old_ptr);
     return tmp;
 }
 
@@ -81,9 +260,41 @@ krealloc(void *old_ptr, size_t newsize)
 void
 kfree(void *ptr)
 {
-    spinlock_acquire(&lock);
-    tlsf_free(tlsf_ctx, ptr);
-    spinlock_release(&lock);
+    struct kalloc_arena *ap, *owner;
+    struct kalloc_hdr *hdr, *head;
+    uint32_t idx;
+    uint64_t intr;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    hdr = (struct kalloc_hdr *)ptr - 1;
+    if (hdr->magic != KALLOC_MAGIC || hdr->arena >= CPU_MAX) {
+        printf("kfree: bad pointer %p\n", ptr);
+        return;
+    }
+
+    hdr->magic = 0;
+    owner = &arenas[hdr->arena];
+
+    intr = md_intr_save();
+    ap = kalloc_arena_get(&idx);
+    if (ap == owner) {
+        spinlock_acquire(&ap->lock);
+        kalloc_drain(ap);
+        tlsf_free(ap->tlsf, hdr);
+        spinlock_release(&ap->lock);
+        md_intr_restore(intr);
+        return;
+    }
+
+    /* Not ours, queue it for the owner */
+    do {
+        head = owner->remote;
+        hdr->next = head;
+    } while (atomic_cas_ptr(&owner->remote, head, hdr) != head);
+    md_intr_restore(intr);
 }
 
 void
@@ -94,12 +305,10 @@ __kalloc_init(void)
         return;
     }
 
-    pool = vm_alloc_frame(KALLOC_POOL_PAGES);
-    if (pool == 0) {
+    /* The first arena is also used by cores not set up yet */
+    if (kalloc_arena_grow(&arenas[0], 0) < 0) {
         panic("__kalloc_init: could not create pool\n");
     }
 
-    pool_va = PHYS_TO_VIRT(pool);
-    tlsf_ctx = tlsf_create_with_pool(pool_va, KALLOC_POOL_SZ);
     is_init = true;
 }
@@ -47,6 +47,10 @@
 #define OMAR_DIR    1
 #define BLOCK_SIZE 512
 
+/* File data is page aligned from this revision on */
+#define OMAR_REV_ALIGN 3
+#define DATA_ALIGN 4096
+
 static struct vop omar_vops;
 static const char *__initrd_root = NULL;
 static size_t initrd_size = 0;
@@ -115,17 +119,20 @@ initrd_get_file(const char *path, struct initrd_node *res)
         memcpy(namebuf, name, hdr->namelen);
         namebuf[hdr->namelen] = '\0';
 
+        /* Skip header and name, right to the data */
+        p = (char *)hdr + sizeof(struct omar_hdr);
+        p += hdr->namelen;
+        if (hdr->type == OMAR_REG && hdr->rev >= OMAR_REV_ALIGN) {
+            p = __initrd_root + ALIGN_UP(p - __initrd_root, DATA_ALIGN);
+        }
+
         /* Compute offset to next block */
         if (hdr->type == OMAR_DIR) {
             off = 512;
         } else {
-            off = ALIGN_UP(sizeof(*hdr) + hdr->namelen + hdr->len, BLOCK_SIZE);
+            off = ALIGN_UP((p - (char *)hdr) + hdr->len, BLOCK_SIZE);
         }
 
-        /* Skip header and name, right to the data */
-        p = (char *)hdr + sizeof(struct omar_hdr);
-        p += hdr->namelen;
-
         if (strcmp(namebuf, path) == 0) {
             node.mode = hdr->mode;
             node.size = hdr->len;
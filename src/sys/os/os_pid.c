@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Description: PID allocation and lookup
+ * Author: Ian Marco Moffett
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/errno.h>
+#include <sys/queue.h>
+#include <sys/cpuvar.h>
+#include <sys/proc.h>
+#include <os/spinlock.h>
+#include <stdbool.h>
+
+#define PID_NWORDS (PID_MAX / 64)
+#define PIDHASH(pid) (&pidhash[(pid) & (PIDHASH_SIZE - 1)])
+
+/*
+ * A chain of processes whose PIDs hash to the
+ * same bucket.
+ *
+ * @q: Processes in this bucket
+ * @lock: Protects the bucket
+ */
+struct pidhash_bucket {
+    TAILQ_HEAD(, proc) q;
+    struct spinlock lock;
+};
+
+static struct pidhash_bucket pidhash[PIDHASH_SIZE];
+static bool is_pidhash_init = false;
+
+/*
+ * PIDs in use are set in the bitmap, the search for a
+ * free one starts after the last one handed out so a
+ * PID is not reused right after it is freed.
+ */
+static uint64_t pid_bitmap[PID_NWORDS];
+static struct spinlock pid_lock;
+static pid_t pid_hint = 1;
+
+/*
+ * Set up the hash table and reserve PID zero
+ *
+ * XXX: pid_lock must be held
+ */
+static void
+pidhash_init(void)
+{
+    for (int i = 0; i < PIDHASH_SIZE; ++i) {
+        TAILQ_INIT(&pidhash[i].q);
+        pidhash[i].lock.lock = 0;
+    }
+
+    pid_bitmap[0] |= BIT(0);
+    is_pidhash_init = true;
+}
+
+/*
+ * Allocate a PID
+ */
+pid_t
+pid_alloc(void)
+{
+    pid_t pid = -EAGAIN;
+    size_t word, start;
+    uint64_t free, intr;
+
+    intr = md_intr_save();
+    spinlock_acquire(&pid_lock);
+    if (!is_pidhash_init) {
+        pidhash_init();
+    }
+
+    /* Go a word at a time, wrapping around once */
+    start = pid_hint / 64;
+    for (size_t i = 0; i <= PID_NWORDS; ++i) {
+        word = (start + i) % PID_NWORDS;
+        free = ~pid_bitmap[word];
+
+        /* Don't go back behind the hint in the first word */
+        if (i == 0) {
+            free &= ~(BIT(pid_hint % 64) - 1);
+        }
+        if (free == 0) {
+            continue;
+        }
+
+        pid = (word * 64) + __builtin_ctzll(free);
+        pid_bitmap[word] |= BIT(pid % 64);
+        pid_hint = (pid + 1) % PID_MAX;
+        break;
+    }
+
+    spinlock_release(&pid_lock);
+    md_intr_restore(intr);
+    return pid;
+}
+
+/*
+ * Release a PID
+ */
+void
+pid_free(pid_t pid)
+{
+    uint64_t intr;
+
+    if (pid <= 0 || pid >= PID_MAX) {
+        return;
+    }
+
+    intr = md_intr_save();
+    spinlock_acquire(&pid_lock);
+    pid_bitmap[pid / 64] &= ~BIT(pid % 64);
+    spinlock_release(&pid_lock);
+    md_intr_restore(intr);
+}
+
+/*
+ * Make a process visible to lookups
+ */
+void
+proc_hash_insert(struct proc *procp)
+{
+    struct pidhash_bucket *bp;
+    uint64_t intr;
+
+    if (procp == NULL || procp->pid <= 0) {
+        return;
+    }
+
+    bp = PIDHASH(procp->pid);
+    intr = md_intr_save();
+    spinlock_acquire(&bp->lock);
+    TAILQ_INSERT_TAIL(&bp->q, procp, lup_link);
+    spinlock_release(&bp->lock);
+    md_intr_restore(intr);
+}
+
+/*
+ * Hide a process from lookups
+ */
+void
+proc_hash_remove(struct proc *procp)
+{
+    struct pidhash_bucket *bp;
+    uint64_t intr;
+
+    if (procp == NULL || procp->pid <= 0) {
+        return;
+    }
+
+    /*
+     * A process that never made it into the table (or
+     * was taken out already) has no back pointer.
+     */
+    bp = PIDHASH(procp->pid);
+    intr = md_intr_save();
+    spinlock_acquire(&bp->lock);
+    if (procp->lup_link.tqe_prev != NULL) {
+        TAILQ_REMOVE(&bp->q, procp, lup_link);
+        procp->lup_link.tqe_prev = NULL;
+    }
+
+    spinlock_release(&bp->lock);
+    md_intr_restore(intr);
+}
+
+/*
+ * Lookup a process by PID
+ */
+struct proc *
+proc_lookup(pid_t pid)
+{
+    struct pidhash_bucket *bp;
+    struct proc *procp;
+    uint64_t intr;
+
+    if (pid <= 0 || !is_pidhash_init) {
+        return NULL;
+    }
+
+    bp = PIDHASH(pid);
+    intr = md_intr_save();
+    spinlock_acquire(&bp->lock);
+    TAILQ_FOREACH(procp, &bp->q, lup_link) {
+        if (procp->pid == pid)
+            break;
+    }
+
+    spinlock_release(&bp->lock);
+    md_intr_restore(intr);
+    return procp;
+}
+
+/*
+ * Orphan the children of a process
+ */
+void
+proc_orphan(struct proc *parent)
+{
+    struct pidhash_bucket *bp;
+    struct proc *procp;
+    uint64_t intr;
+
+    if (parent == NULL || !is_pidhash_init) {
+        return;
+    }
+
+    for (int i = 0; i < PIDHASH_SIZE; ++i) {
+        bp = &pidhash[i];
+        intr = md_intr_save();
+        spinlock_acquire(&bp->lock);
+        TAILQ_FOREACH(procp, &bp->q, lup_link) {
+            if (procp->parent == parent)
+                procp->parent = NULL;
+        }
+
+        spinlock_release(&bp->lock);
+        md_intr_restore(intr);
+    }
+}
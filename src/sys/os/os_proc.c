@@ -40,32 +40,44 @@
 #include <os/systm.h>
 #include <vm/vm.h>
 #include <vm/physseg.h>
+#include <vm/kmem.h>
+#include <vm/fault.h>
+#include <vm/mmu.h>
+#include <vm/map.h>
+#include <vm/range.h>
 #include <os/ucred.h>
 #include <os/elfload.h>
 #include <os/signal.h>
 #include <os/kalloc.h>
 #include <os/filedesc.h>
+#include <os/wchan.h>
 #include <string.h>
 #include <stdbool.h>
 
-/*
- * System-wide process state
- *
- * XXX: The process queue here is different from the runqueues,
- *      these keep track of the processes present whether they
- *      are running or not (unless terminated)
- */
-static bool is_procq_init = false;
-static TAILQ_HEAD(, proc) procq;
-static pid_t next_pid = 0;
+/* Orders exits against waitpid() */
+static struct spinlock exit_lock;
+
+static struct kmem_cache proc_cache = KMEM_CACHE_INIT(
+    "proc",
+    sizeof(struct proc),
+    NULL
+);
+
+extern struct proc g_rootproc;
 
 /*
  * Copy a process environment block from userland
+ *
+ * @procp: Process the block belongs to
+ * @u_blk: User copy of the block
+ * @box_res: Box holding the arguments is written here
  */
 static struct penv_blk *
-penv_blk_cpy(struct proc *procp, struct penv_blk *u_blk)
+penv_blk_cpy(struct proc *procp, struct penv_blk *u_blk,
+    struct ptrbox **box_res)
 {
     struct penv_blk *blk;
+    struct ptrbox *box;
     int error;
     char argbuf[ARG_LEN];
     char **u_argv;
@@ -99,17 +111,16 @@ penv_blk_cpy(struct proc *procp, struct penv_blk *u_blk)
     }
 
     /* Allocate a pointer box for args */
-    if (ptrbox_init(&procp->envblk_box) < 0) {
+    if (ptrbox_init(&box) < 0) {
+        kfree(blk);
         return NULL;
     }
 
     /* Allocate a new string store */
     u_argv = blk->argv;
-    blk->argv = ptrbox_alloc(
-        sizeof(char *) * blk->argc,
-        procp->envblk_box
-    );
+    blk->argv = ptrbox_alloc(sizeof(char *) * blk->argc, box);
     if (blk->argv == NULL) {
+        ptrbox_terminate(box);
         kfree(blk);
         return NULL;
     }
@@ -119,7 +130,8 @@ penv_blk_cpy(struct proc *procp, struct penv_blk *u_blk)
         error = proc_check_addr(
             procp,
             (uintptr_t)&u_argv[i],
-            sizeof(char *)
+            sizeof(char *),
+            PROT_READ
         );
 
         /* Is the address valid? */
@@ -134,16 +146,17 @@ penv_blk_cpy(struct proc *procp, struct penv_blk *u_blk)
             break;
         }
 
-        blk->argv[i] = ptrbox_strdup(argbuf, procp->envblk_box);
+        blk->argv[i] = ptrbox_strdup(argbuf, box);
     }
 
     /* Cleanup on error */
     if (error != 0) {
-        ptrbox_terminate(procp->envblk_box);
+        ptrbox_terminate(box);
         kfree(blk);
-        blk = NULL;
+        return NULL;
     }
 
+    *box_res = box;
     return blk;
 }
 
@@ -156,17 +169,31 @@ static void
 proc_clear_ranges(struct proc *proc)
 {
     const size_t PSIZE = DEFAULT_PAGESIZE;
+    struct vm_vas *vas = &proc->pcb.vas;
     struct vm_range *range;
     size_t n_pages;
+    paddr_t pa;
+
+    spinlock_acquire(&proc->maplist_lock);
+    while ((range = RB_ROOT(&proc->maplist)) != NULL) {
+        n_pages = ALIGN_UP(range->len, PSIZE) / PSIZE;
 
-    TAILQ_FOREACH(range, &proc->maplist, link) {
-        if (range == NULL) {
-            continue;
+        /*
+         * Lazy ranges hold a reference to each frame that
+         * was faulted in or shared with them.
+         */
+        if (ISSET(range->flags, VM_RANGE_LAZY)) {
+            for (size_t i = 0; i < n_pages; ++i) {
+                if (mmu_translate(vas, range->va_base + i * PSIZE, &pa) == 0)
+                    vm_frame_unref(pa);
+            }
+        } else if (ISSET(range->flags, VM_RANGE_OWNED)) {
+            vm_free_frame(range->pa_base, n_pages);
         }
 
-        n_pages = ALIGN_UP(range->len, PSIZE) / PSIZE;
-        vm_free_frame(range->pa_base, n_pages);
+        proc_del_range(proc, range);
     }
+    spinlock_release(&proc->maplist_lock);
 }
 
 /*
@@ -175,14 +202,11 @@ proc_clear_ranges(struct proc *proc)
 int
 proc_sleep(struct proc *proc)
 {
-    struct pcore *core = this_core();
-
-    if (proc == NULL || core == NULL) {
+    if (proc == NULL || proc != proc_self()) {
         return -EINVAL;
     }
 
-    proc->flags |= PROC_SLEEPING;
-    md_proc_sleep();
+    wchan_sleep(proc, NULL);
     return 0;
 }
 
@@ -192,17 +216,14 @@ proc_sleep(struct proc *proc)
 int
 proc_wake(struct proc *proc)
 {
-    struct pcore *core = cpu_sched();
-
-    if (core == NULL || proc == NULL) {
-        return -1;
+    if (proc == NULL) {
+        return -EINVAL;
     }
 
-    if (!ISSET(proc->flags, PROC_SLEEPING)) {
-        return -1;
+    if (wchan_wakeup(proc) == 0) {
+        return -ESRCH;
     }
 
-    proc->flags &= ~PROC_SLEEPING;
     return 0;
 }
 
@@ -220,16 +241,10 @@ proc_init(struct proc *procp, int flags)
         return -EINVAL;
     }
 
-    /* Initialize the process queue once */
-    if (!is_procq_init) {
-        TAILQ_INIT(&procq);
-        is_procq_init = true;
-    }
-
     /* Put the process in a known state */
     scdp = &procp->scdom;
     memset(procp, 0, sizeof(*procp));
-    TAILQ_INIT(&procp->maplist);
+    RB_INIT(&procp->maplist);
 
     /*
      * Initialize each platform latch
@@ -245,7 +260,12 @@ proc_init(struct proc *procp, int flags)
         }
     }
 
-    procp->pid = atomic_inc_int(&next_pid);
+    if ((procp->pid = pid_alloc()) < 0) {
+        error = procp->pid;
+        procp->pid = 0;
+        return error;
+    }
+
     error = md_proc_init(procp, flags);
     if (error < 0) {
         return error;
@@ -260,49 +280,83 @@ proc_init(struct proc *procp, int flags)
 }
 
 /*
- * Lookup a process by PID
+ * Add range to process
  */
-struct proc *
-proc_lookup(pid_t pid)
+int
+proc_add_range(struct proc *procp, vaddr_t va, paddr_t pa, size_t len,
+    int prot, int flags)
 {
-    struct proc *curproc;
+    const size_t PSIZE = DEFAULT_PAGESIZE;
+    struct vm_range *range;
+    int error;
 
-    TAILQ_FOREACH(curproc, &procq, lup_link) {
-        if (curproc == NULL) {
-            continue;
-        }
+    if (procp == NULL) {
+        return -EINVAL;
+    }
 
-        if (curproc->pid == pid) {
-            return curproc;
-        }
+    range = vm_range_alloc();
+    if (range == NULL) {
+        return -ENOMEM;
+    }
+
+    range->pa_base = ALIGN_DOWN(pa, PSIZE);
+    range->va_base = ALIGN_DOWN(va, PSIZE);
+    range->len = ALIGN_UP(len + (va - range->va_base), PSIZE);
+    range->prot = prot;
+    range->flags = flags;
+
+    error = vm_range_insert(&procp->maplist, range);
+    if (error < 0) {
+        vm_range_free(range);
+        return error;
     }
 
-    return NULL;
+    return 0;
 }
 
 /*
- * Add range to process
+ * Remove a range from a process
  */
-int
-proc_add_range(struct proc *procp, vaddr_t va, paddr_t pa, size_t len)
+void
+proc_del_range(struct proc *procp, struct vm_range *range)
+{
+    if (procp == NULL || range == NULL) {
+        return;
+    }
+
+    if (procp->last_range == range) {
+        procp->last_range = NULL;
+    }
+
+    vm_range_remove(&procp->maplist, range);
+    vm_range_free(range);
+}
+
+/*
+ * Find the range containing an address
+ */
+struct vm_range *
+proc_find_range(struct proc *procp, vaddr_t va)
 {
-    const size_t PSIZE = DEFAULT_PAGESIZE;
     struct vm_range *range;
 
     if (procp == NULL) {
-        return -EINVAL;
+        return NULL;
     }
 
-    range = kalloc(sizeof(*range));
-    if (range == NULL) {
-        return -ENOMEM;
+    /* The same buffers tend to get passed over and over */
+    range = procp->last_range;
+    if (range != NULL) {
+        if (va >= range->va_base && va < (range->va_base + range->len))
+            return range;
     }
 
-    range->pa_base = pa;
-    range->va_base = va;
-    range->len = ALIGN_UP(len, PSIZE);
-    TAILQ_INSERT_TAIL(&procp->maplist, range, link);
-    return 0;
+    range = vm_range_find(&procp->maplist, va);
+    if (range != NULL) {
+        procp->last_range = range;
+    }
+
+    return range;
 }
 
 /*
@@ -311,25 +365,65 @@ proc_add_range(struct proc *procp, vaddr_t va, paddr_t pa, size_t len)
 int
 proc_kill(struct proc *procp, int status)
 {
-    struct proc *self = proc_self();
+    uint64_t intr;
 
     if (procp == NULL) {
         return -EINVAL;
     }
 
+    intr = md_intr_save();
+    spinlock_acquire(&exit_lock);
+    procp->flags |= PROC_EXITING;
+    proc_hash_remove(procp);
+    spinlock_release(&exit_lock);
+    md_intr_restore(intr);
+
     /*
-     * Try to wake up our parent if they are sleeping
-     * at all.
+     * Anyone in waitpid() on us sleeps on our channel,
+     * the reaper cleans up the rest.
      */
-    if (self->pid == procp->pid) {
-        if (self->parent != NULL)
-            proc_wake(self->parent);
+    wchan_wakeup(procp);
+    return md_proc_kill(procp, 0);
+}
+
+/*
+ * Free a dead process
+ */
+void
+proc_free(struct proc *procp)
+{
+    if (procp == NULL) {
+        return;
     }
 
-    procp->flags |= PROC_EXITING;
+    /* Nobody may find us and our children are on their own */
+    proc_hash_remove(procp);
+    proc_orphan(procp);
+
     proc_clear_ranges(procp);
-    TAILQ_REMOVE(&procq, procp, lup_link);
-    return md_proc_kill(procp, 0);
+    fdtab_free(procp);
+    if (procp->envblk != NULL) {
+        kfree(procp->envblk);
+        procp->envblk = NULL;
+    }
+    if (procp->envblk_box != NULL) {
+        ptrbox_terminate(procp->envblk_box);
+        procp->envblk_box = NULL;
+    }
+
+    if (procp->pcb.vas.cr3 != 0) {
+        mmu_free_vas(&procp->pcb.vas);
+    }
+
+    md_proc_free(procp);
+
+    /* Only now may the PID be handed out again */
+    pid_free(procp->pid);
+
+    /* The root process was never allocated */
+    if (procp != &g_rootproc) {
+        kmem_cache_free(&proc_cache, procp);
+    }
 }
 
 
@@ -338,25 +432,39 @@ proc_kill(struct proc *procp, int status)
  * process.
  */
 int
-proc_check_addr(struct proc *proc, uintptr_t addr, size_t len)
+proc_check_addr(struct proc *proc, uintptr_t addr, size_t len, int prot)
 {
-    uintptr_t stack_base;
-    uintptr_t stack_end;
+    struct vm_range *range;
+    uintptr_t end = addr + len;
 
-    /* Within the bounds of the stack? */
-    stack_base = STACK_TOP - STACK_LEN;
-    if (addr >= stack_base && addr <= STACK_TOP) {
-        return 0;
-    }
-    if ((stack_base + len) < stack_end) {
-        return 0;
+    if (proc == NULL || end < addr) {
+        return -EFAULT;
     }
 
-    return -EFAULT;
+    /*
+     * Every byte must be covered by some range that
+     * allows the access, the stack may be grown to
+     * cover the area if needed, its pages are faulted
+     * in when touched.
+     */
+    spinlock_acquire(&proc->maplist_lock);
+    while (addr < end) {
+        range = proc_find_range(proc, addr);
+        if (range == NULL)
+            range = vm_stack_grow(proc, addr);
+        if (range == NULL)
+            break;
+        if (ISSET(prot, ~range->prot & (PROT_READ | PROT_WRITE)))
+            break;
+
+        addr = range->va_base + range->len;
+    }
+    spinlock_release(&proc->maplist_lock);
+    return (addr >= end) ? 0 : -EFAULT;
 }
 
 int
-proc_spawn(const char *path, struct penv_blk *envbp)
+proc_spawn(const char *path, struct penv_blk *envbp, struct ptrbox *envbox)
 {
     struct pcore *core;
     struct loaded_elf elf;
@@ -368,15 +476,23 @@ proc_spawn(const char *path, struct penv_blk *envbp)
     }
 
     /* Allocate a new process */
-    proc = kalloc(sizeof(*proc));
+    proc = kmem_cache_alloc(&proc_cache);
     if (proc == NULL) {
+        if (envbox != NULL)
+            ptrbox_terminate(envbox);
+
+        kfree(envbp);
         return -ENOMEM;
     }
 
-    proc_init(proc, 0);
-    error = elf_load(path, proc, &elf);
+    error = proc_init(proc, 0);
+    proc->envblk = envbp;
+    proc->envblk_box = envbox;
+    if (error == 0) {
+        error = elf_load(path, proc, &elf);
+    }
     if (error < 0) {
-        kfree(proc);
+        proc_free(proc);
         return error;
     }
 
@@ -385,50 +501,134 @@ proc_spawn(const char *path, struct penv_blk *envbp)
         panic("spawn: failed to arbitrate core\n");
     }
 
-    proc->envblk = envbp;
     proc->parent = proc_self();
     error = ucred_init(proc->parent, &proc->cred);
     if (error < 0) {
-        kfree(proc);
+        proc_free(proc);
         return error;
     }
 
+    /* It may exit as soon as it is queued */
     md_set_ip(proc, elf.entrypoint);
+    proc_hash_insert(proc);
     sched_enq(&core->scq, proc);
-    TAILQ_INSERT_TAIL(&procq, proc, lup_link);
     return proc->pid;
 }
 
 int
-proc_ktd(struct proc **procp_res, void(*fn)(void *))
+proc_fork(struct proc *parent)
 {
-    struct proc *proc;
     struct pcore *core;
+    struct proc *child;
+    int error;
 
-    if (procp_res == NULL || fn == NULL) {
+    if (parent == NULL) {
         return -EINVAL;
     }
 
-    proc = kalloc(sizeof(*proc));
-    if (proc == NULL) {
+    child = kmem_cache_alloc(&proc_cache);
+    if (child == NULL) {
         return -ENOMEM;
     }
 
+    /* Start out with an empty address space */
+    if ((error = proc_init(child, SPAWN_FORK)) < 0) {
+        proc_free(child);
+        return error;
+    }
+
+    child->parent = parent;
+    child->cred = parent->cred;
+    child->level = parent->level;
+    child->scdom = parent->scdom;
+    memcpy(&child->sigtab, &parent->sigtab, sizeof(child->sigtab));
+
+    error = vm_fork(parent, child);
+    if (error == 0) {
+        error = fdtab_copy(child, parent);
+    }
+    if (error == 0) {
+        error = md_proc_fork(child, parent);
+    }
+
+    if (error < 0) {
+        proc_free(child);
+        return error;
+    }
+
     core = cpu_sched();
-    if (core == NULL) {
-        kfree(proc);
-        return -EIO;
+    if (__unlikely(core == NULL)) {
+        panic("fork: failed to arbitrate core\n");
     }
 
-    proc_init(proc, SPAWN_KTD);
-    md_set_ip(proc, (uintptr_t)fn);
-    sched_enq(&core->scq, proc);
+    proc_hash_insert(child);
+    sched_enq(&core->scq, child);
+    return child->pid;
+}
+
+/*
+ * Create a kernel thread on a specific core
+ *
+ * @procp_res: Result is written here
+ * @fn: Function where kernel thread should end up
+ * @core: Core to run the thread on
+ * @flags: Extra process flags (PROC_*)
+ */
+static int
+ktd_create(struct proc **procp_res, void(*fn)(void *), struct pcore *core,
+    uint32_t flags)
+{
+    struct proc *proc;
+    int error;
+
+    if (procp_res == NULL || fn == NULL || core == NULL) {
+        return -EINVAL;
+    }
+
+    proc = kmem_cache_alloc(&proc_cache);
+    if (proc == NULL) {
+        return -ENOMEM;
+    }
 
+    if ((error = proc_init(proc, SPAWN_KTD)) < 0) {
+        proc_free(proc);
+        return error;
+    }
+
+    proc->flags |= flags;
+    md_set_ip(proc, (uintptr_t)fn);
     *procp_res = proc;
-    TAILQ_INSERT_TAIL(&procq, proc, lup_link);
+    proc_hash_insert(proc);
+    sched_enq(&core->scq, proc);
     return 0;
 }
 
+int
+proc_ktd(struct proc **procp_res, void(*fn)(void *))
+{
+    struct pcore *core;
+
+    if ((core = cpu_sched()) == NULL) {
+        return -EIO;
+    }
+
+    return ktd_create(procp_res, fn, core, 0);
+}
+
+int
+proc_idle_td(struct pcore *core, void(*fn)(void *))
+{
+    struct proc *proc;
+
+    return ktd_create(&proc, fn, core, PROC_IDLE);
+}
+
+int
+proc_bound_td(struct pcore *core, struct proc **procp_res, void(*fn)(void *))
+{
+    return ktd_create(procp_res, fn, core, PROC_PINNED);
+}
+
 /*
  * ARG0: Pathname to spawn
  * ARG1: Process environment block
@@ -439,6 +639,7 @@ sys_spawn(struct syscall_args *scargs)
     const char *u_path = SCARG(scargs, const char *, 0);
     struct penv_blk *u_blk = SCARG(scargs, struct penv_blk *, 1);
     struct penv_blk *envblk;
+    struct ptrbox *envbox = NULL;
     char buf[PATH_MAX];
     int error;
 
@@ -447,8 +648,17 @@ sys_spawn(struct syscall_args *scargs)
         return error;
     }
 
-    envblk = penv_blk_cpy(proc_self(), u_blk);
-    return proc_spawn(buf, envblk);
+    envblk = penv_blk_cpy(proc_self(), u_blk, &envbox);
+    return proc_spawn(buf, envblk, envbox);
+}
+
+/*
+ * Duplicate the current process
+ */
+scret_t
+sys_fork(struct syscall_args *scargs)
+{
+    return proc_fork(proc_self());
 }
 
 /*
@@ -493,11 +703,7 @@ sys_waitpid(struct syscall_args *scargs)
     int *u_status = SCARG(scargs, int *, 1);
     int status = 0;
     int error = 0;
-    struct proc *proc, *self;
-
-    if ((proc = proc_lookup(pid)) == NULL) {
-        return -ESRCH;
-    }
+    struct proc *proc;
 
     if (u_status != NULL) {
         error = copyout(&status, u_status, sizeof(*u_status));
@@ -506,7 +712,16 @@ sys_waitpid(struct syscall_args *scargs)
         return error;
     }
 
-    self = proc_self();
-    proc_sleep(self);
+    /*
+     * The child cannot exit between the lookup and us
+     * going to sleep on it, the wakeup would be lost.
+     */
+    spinlock_acquire(&exit_lock);
+    if ((proc = proc_lookup(pid)) == NULL) {
+        spinlock_release(&exit_lock);
+        return -ESRCH;
+    }
+
+    wchan_sleep(proc, &exit_lock);
     return 0;
 }
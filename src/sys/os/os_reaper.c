@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Description: Dead process reaper
+ * Author: Ian Marco Moffett
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/syslog.h>
+#include <sys/proc.h>
+#include <sys/cpuvar.h>
+#include <os/spinlock.h>
+#include <os/module.h>
+#include <os/wchan.h>
+
+/*
+ * A process cannot free the address space it is
+ * running on, nor the descriptors it may be in the
+ * middle of using, so the last bits of teardown are
+ * deferred to the reaper thread.
+ */
+static struct spinlock reap_lock;
+static TAILQ_HEAD(, proc) reapq = TAILQ_HEAD_INITIALIZER(reapq);
+
+/*
+ * Queue a dead process to be freed
+ */
+void
+proc_reap(struct proc *procp)
+{
+    if (procp == NULL) {
+        return;
+    }
+
+    spinlock_acquire(&reap_lock);
+    TAILQ_INSERT_TAIL(&reapq, procp, link);
+    spinlock_release(&reap_lock);
+    wchan_wakeup(&reapq);
+}
+
+static void
+reaper_main(void *arg)
+{
+    TAILQ_HEAD(, proc) batch;
+    struct proc *procp;
+    uint64_t intr;
+
+    for (;;) {
+        TAILQ_INIT(&batch);
+
+        /*
+         * Take everything that is queued in one go, a process
+         * exiting on this core must not find the lock held
+         * by us while we are switched away.
+         */
+        intr = md_intr_save();
+        spinlock_acquire(&reap_lock);
+        if (TAILQ_EMPTY(&reapq)) {
+            wchan_sleep(&reapq, &reap_lock);
+            md_intr_restore(intr);
+            continue;
+        }
+
+        TAILQ_CONCAT(&batch, &reapq, link);
+        spinlock_release(&reap_lock);
+        md_intr_restore(intr);
+
+        while ((procp = TAILQ_FIRST(&batch)) != NULL) {
+            TAILQ_REMOVE(&batch, procp, link);
+            proc_free(procp);
+        }
+    }
+}
+
+static int
+reaper_init(struct module *modp)
+{
+    struct proc *td;
+    int error;
+
+    error = proc_ktd(&td, reaper_main);
+    if (error < 0) {
+        printf("reaper: could not start reaper thread\n");
+        return error;
+    }
+
+    return 0;
+}
+
+MODULE_EXPORT("reaper", MODTYPE_GENERIC, reaper_init);
@@ -38,42 +38,365 @@
 #include <sys/syslog.h>
 #include <sys/panic.h>
 #include <sys/queue.h>
+#include <sys/atomic.h>
 #include <sys/cpuvar.h>
 #include <os/sched.h>
+#include <os/wchan.h>
+#include <os/callout.h>
+
+/* From kconf */
+#if defined(__SCHED_ARBITER)
+#define SCHED_ARBITER __SCHED_ARBITER
+#else
+#define SCHED_ARBITER CORE_ARBITER_P2C
+#endif
 
 __cacheline_aligned
 static struct core_arbiter arbiter = {
     .rr_id = 0,
-    .type = CORE_ARBITER_RR
+    .seq = 0,
+    .type = SCHED_ARBITER
 };
 
+/*
+ * Get the load of a core, this is a racy peek that
+ * is only ever used as a hint.
+ *
+ * @core: Core to check
+ */
+static inline size_t
+core_load(struct pcore *core)
+{
+    size_t load = core->scq.nrun;
+
+    /* Count what is running right now too */
+    if (core->curproc != NULL && core->curproc != core->scq.idle) {
+        ++load;
+    }
+
+    return load;
+}
+
+/*
+ * Get a pseudo-random number without any shared
+ * state besides a single counter (splitmix64)
+ */
+static inline uint64_t
+arbiter_rand(void)
+{
+    uint64_t x;
+
+    x = atomic_inc_64(&arbiter.seq) * 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/*
+ * Pick the least loaded core
+ *
+ * @ncores: Number of cores online
+ */
+static struct pcore *
+arbiter_least(size_t ncores)
+{
+    struct pcore *core, *best = NULL;
+    size_t load, best_load = 0;
+    size_t start;
+
+    /* Start somewhere different each time to break ties */
+    start = atomic_inc_64(&arbiter.rr_id);
+    for (size_t i = 0; i < ncores; ++i) {
+        if ((core = cpu_get((start + i) % ncores)) == NULL)
+            continue;
+
+        load = core_load(core);
+        if (best == NULL || load < best_load) {
+            best = core;
+            best_load = load;
+        }
+
+        /* Can't do better than idle */
+        if (best_load == 0)
+            break;
+    }
+
+    return best;
+}
+
+/*
+ * Pick the less loaded of two random cores
+ *
+ * @ncores: Number of cores online
+ */
+static struct pcore *
+arbiter_p2c(size_t ncores)
+{
+    struct pcore *a, *b;
+    uint64_t r = arbiter_rand();
+
+    a = cpu_get(r % ncores);
+    b = cpu_get((r >> 32) % ncores);
+    if (a == NULL || b == NULL) {
+        return (a != NULL) ? a : b;
+    }
+
+    return (core_load(b) < core_load(a)) ? b : a;
+}
+
+/*
+ * Pick the current core unless it has more work
+ * than a core picked by two choices, this keeps
+ * things that were just forked near their parent.
+ *
+ * @ncores: Number of cores online
+ */
+static struct pcore *
+arbiter_affine(size_t ncores)
+{
+    struct pcore *self, *other;
+
+    self = this_core();
+    other = arbiter_p2c(ncores);
+    if (self == NULL || other == NULL) {
+        return (self != NULL) ? self : other;
+    }
+
+    if (core_load(self) <= core_load(other) + 1) {
+        return self;
+    }
+
+    return other;
+}
+
 /*
  * Schedule the next processor core
  */
 struct pcore *
 cpu_sched(void)
 {
-    struct pcore *retval;
+    size_t ncores = cpu_count();
+
+    if (ncores <= 1) {
+        return cpu_get(0);
+    }
 
-    spinlock_acquire(&arbiter.lock);
     switch (arbiter.type) {
+    case CORE_ARBITER_LEAST:
+        return arbiter_least(ncores);
+    case CORE_ARBITER_P2C:
+        return arbiter_p2c(ncores);
+    case CORE_ARBITER_AFFINE:
+        return arbiter_affine(ncores);
     case CORE_ARBITER_RR:
-        retval = cpu_get(arbiter.rr_id++);
-
-        /*
-         * If we made it at the end, wrap to the beginning.
-         * XXX: Us getting entry 0 would make the next be 1.
-         */
-        if (retval == NULL) {
-            arbiter.rr_id = 1;
-            retval = cpu_get(0);
+        break;
+    }
+
+    /* Every core gets an equal turn */
+    return cpu_get(atomic_inc_64(&arbiter.rr_id) % ncores);
+}
+
+/*
+ * Move every process in a queue back up to the
+ * highest level.
+ *
+ * @q: Queue to boost
+ *
+ * XXX: Queue lock must be held
+ */
+static void
+sched_boost_all(struct sched_queue *q)
+{
+    struct proc *proc;
+
+    for (int i = 1; i < SCHED_NQUEUES; ++i) {
+        TAILQ_FOREACH(proc, &q->q[i], link) {
+            proc->sched_lvl = 0;
         }
 
-        break;
+        TAILQ_CONCAT(&q->q[0], &q->q[i], link);
+    }
+
+    q->elapsed = 0;
+}
+
+/*
+ * Get the quantum of a process
+ */
+size_t
+sched_quantum(struct proc *proc)
+{
+    if (proc == NULL) {
+        return SCHED_QUANTUM;
+    }
+
+    return SCHED_QUANTUM << proc->sched_lvl;
+}
+
+/*
+ * Demote a process a level
+ */
+void
+sched_demote(struct proc *proc)
+{
+    if (proc == NULL) {
+        return;
+    }
+
+    if (proc->sched_lvl < (SCHED_NQUEUES - 1)) {
+        ++proc->sched_lvl;
+    }
+}
+
+/*
+ * Handle a process being switched away from
+ */
+void
+sched_preempt(struct pcore *core, struct proc *proc)
+{
+    struct sched_queue *q;
+    bool kicked;
+
+    if (core == NULL) {
+        return;
+    }
+
+    /*
+     * We are in the scheduler now, nobody needs to kick
+     * us until we decide on the timer again.
+     */
+    q = &core->scq;
+    spinlock_acquire(&q->lock);
+    kicked = q->kicked;
+    q->kicked = false;
+    q->tickless = false;
+    spinlock_release(&q->lock);
+
+    /* Its quantum did not run out if we were kicked */
+    if (proc == NULL || kicked) {
+        return;
+    }
+
+    if (!ISSET(proc->flags, PROC_SLEEPING)) {
+        sched_demote(proc);
+    }
+}
+
+/*
+ * Get the time until the next event for a core
+ */
+size_t
+sched_next_event(struct pcore *core, struct proc *proc)
+{
+    struct sched_queue *q;
+    size_t usec = 0, cusec;
+    bool idle;
+
+    if (core == NULL) {
+        return SCHED_QUANTUM;
+    }
+
+    q = &core->scq;
+    idle = (proc == NULL || proc == q->idle);
+    cusec = callout_next_event(core);
+
+    spinlock_acquire(&q->lock);
+    if (!idle && q->nrun > 0) {
+        /* Others are waiting on this one */
+        usec = sched_quantum(proc);
+    }
+
+    /* A callout may need us before that */
+    if (cusec != 0 && (usec == 0 || cusec < usec)) {
+        usec = cusec;
+    }
+
+    q->tickless = (usec == 0);
+    q->idling = idle;
+    spinlock_release(&q->lock);
+    return usec;
+}
+
+/*
+ * Kick a core into the scheduler
+ */
+void
+sched_kick(struct pcore *core)
+{
+    struct sched_queue *q;
+
+    if (core == NULL) {
+        return;
+    }
+
+    q = &core->scq;
+    spinlock_acquire(&q->lock);
+    q->tickless = false;
+    q->kicked = true;
+    spinlock_release(&q->lock);
+    md_sched_kick(core);
+}
+
+/*
+ * Boost a process to the highest level
+ */
+void
+sched_boost(struct proc *proc)
+{
+    if (proc == NULL) {
+        return;
     }
 
-    spinlock_release(&arbiter.lock);
-    return retval;
+    proc->sched_lvl = 0;
+}
+
+/*
+ * Check if a queue has work piling up that another
+ * core could take.
+ *
+ * @q: Queue to check
+ * @proc: Process that was just queued
+ *
+ * XXX: Queue lock must be held
+ */
+static inline bool
+sched_backlog(struct sched_queue *q, struct proc *proc)
+{
+    struct proc *cur = q->core->curproc;
+
+    if (q->nrun >= 2) {
+        return true;
+    }
+
+    /* Just queued behind something that is running */
+    if (q->nrun == 1 && cur != NULL) {
+        return cur != proc && cur != q->idle;
+    }
+
+    return false;
+}
+
+/*
+ * Wake up a core that has nothing to run so it
+ * can take work from a busy one.
+ *
+ * @busy: Core that has work piling up
+ */
+static void
+sched_kick_idle(struct pcore *busy)
+{
+    struct pcore *core;
+    size_t ncores = cpu_count();
+
+    for (size_t i = 1; i < ncores; ++i) {
+        core = cpu_get((busy->id + i) % ncores);
+        if (core == NULL || !core->scq.idling) {
+            continue;
+        }
+
+        md_sched_kick(core);
+        return;
+    }
 }
 
 /*
@@ -82,14 +405,46 @@ cpu_sched(void)
 int
 sched_enq(struct sched_queue *q, struct proc *proc)
 {
+    bool kick = false, backlog = false;
+
     if (q == NULL || proc == NULL) {
         return -EINVAL;
     }
 
     spinlock_acquire(&q->lock);
-    TAILQ_INSERT_TAIL(&q->q, proc, link);
+
+    /* The idle thread stays off of the queues */
+    if (ISSET(proc->flags, PROC_IDLE)) {
+        q->idle = proc;
+        spinlock_release(&q->lock);
+        return 0;
+    }
+
+    TAILQ_INSERT_TAIL(&q->q[proc->sched_lvl], proc, link);
+    proc->sched_stamp = q->ticks;
     ++q->nproc;
+    ++q->nrun;
+
+    /*
+     * If the core has no timer armed it will not notice
+     * this on its own, otherwise see if someone idle can
+     * help out.
+     */
+    if (q->tickless) {
+        q->tickless = false;
+        q->kicked = true;
+        kick = true;
+    } else if (q->core != NULL) {
+        backlog = sched_backlog(q, proc);
+    }
+
     spinlock_release(&q->lock);
+    if (kick) {
+        md_sched_kick(q->core);
+    } else if (backlog) {
+        sched_kick_idle(q->core);
+    }
+
     return 0;
 }
 
@@ -99,7 +454,8 @@ sched_enq(struct sched_queue *q, struct proc *proc)
 int
 sched_deq(struct sched_queue *q, struct proc **procp)
 {
-    struct proc *proc;
+    struct proc *proc = NULL;
+    int lvl;
 
     if (q == NULL || procp == NULL) {
         return -EINVAL;
@@ -111,19 +467,11 @@ sched_deq(struct sched_queue *q, struct proc **procp)
     }
 
     spinlock_acquire(&q->lock);
-    if ((proc = TAILQ_FIRST(&q->q)) == NULL) {
-        spinlock_release(&q->lock);
-        return -EAGAIN;
-    }
-
-    /* Find a process that is not sleeping */
-    while (proc != NULL) {
-        if (ISSET(proc->flags, PROC_SLEEPING)) {
-            proc = TAILQ_NEXT(proc, link);
-            continue;
-        }
 
-        break;
+    /* Take from the highest level that has anything */
+    for (lvl = 0; lvl < SCHED_NQUEUES; ++lvl) {
+        if ((proc = TAILQ_FIRST(&q->q[lvl])) != NULL)
+            break;
     }
 
     /* Is there anything? */
@@ -132,13 +480,144 @@ sched_deq(struct sched_queue *q, struct proc **procp)
         return -EAGAIN;
     }
 
-    TAILQ_REMOVE(&q->q, proc, link);
+    TAILQ_REMOVE(&q->q[lvl], proc, link);
     *procp = proc;
     --q->nproc;
+    --q->nrun;
+    ++q->ticks;
+
+    /* Age the queue */
+    q->elapsed += sched_quantum(proc);
+    if (q->elapsed >= SCHED_BOOST_USEC) {
+        sched_boost_all(q);
+    }
+
     spinlock_release(&q->lock);
     return 0;
 }
 
+/*
+ * Take a process from the queue of another core,
+ * batch jobs in the lowest levels are taken first as
+ * they care the least about where they run.
+ *
+ * @q: Queue to steal from
+ * @procp: Result of the stolen process is written here
+ *
+ * Returns zero on success
+ */
+static int
+sched_steal_from(struct sched_queue *q, struct proc **procp)
+{
+    struct proc *proc;
+
+    spinlock_acquire(&q->lock);
+    for (int lvl = SCHED_NQUEUES - 1; lvl >= 0; --lvl) {
+        TAILQ_FOREACH(proc, &q->q[lvl], link) {
+            /* Leave it be if it just ran over there */
+            if ((q->ticks - proc->sched_stamp) < SCHED_HOT_TICKS)
+                continue;
+            if (ISSET(proc->flags, PROC_PINNED))
+                continue;
+
+            TAILQ_REMOVE(&q->q[lvl], proc, link);
+            --q->nproc;
+            --q->nrun;
+            spinlock_release(&q->lock);
+            *procp = proc;
+            return 0;
+        }
+    }
+
+    spinlock_release(&q->lock);
+    return -EAGAIN;
+}
+
+/*
+ * Take a process from the busiest core
+ *
+ * @self: Core that wants work
+ * @procp: Result of the stolen process is written here
+ *
+ * XXX: Only one queue lock is held at a time, so there
+ *      is no lock ordering to worry about.
+ */
+static int
+sched_steal(struct pcore *self, struct proc **procp)
+{
+    struct pcore *core, *victim = NULL;
+    size_t ncores = cpu_count();
+    size_t nrun, most = 0;
+
+    for (size_t i = 0; i < ncores; ++i) {
+        if ((core = cpu_get(i)) == NULL || core == self)
+            continue;
+
+        /* A racy peek is fine, this is only a hint */
+        nrun = core->scq.nrun;
+        if (nrun > most) {
+            most = nrun;
+            victim = core;
+        }
+    }
+
+    if (victim == NULL) {
+        return -EAGAIN;
+    }
+
+    return sched_steal_from(&victim->scq, procp);
+}
+
+/*
+ * Pick the next process to run on a core
+ */
+int
+sched_next(struct pcore *core, struct proc **procp)
+{
+    struct sched_queue *q;
+
+    if (core == NULL || procp == NULL) {
+        return -EINVAL;
+    }
+
+    q = &core->scq;
+    if (sched_deq(q, procp) == 0) {
+        return 0;
+    }
+
+    if (sched_steal(core, procp) == 0) {
+        return 0;
+    }
+
+    /* Nothing else to do */
+    if ((*procp = q->idle) == NULL) {
+        return -EAGAIN;
+    }
+
+    return 0;
+}
+
+/*
+ * Initialize a scheduler queue
+ */
+void
+sched_queue_init(struct sched_queue *q, struct pcore *core)
+{
+    for (int i = 0; i < SCHED_NQUEUES; ++i) {
+        TAILQ_INIT(&q->q[i]);
+    }
+
+    q->idle = NULL;
+    q->core = core;
+    q->tickless = false;
+    q->idling = false;
+    q->kicked = false;
+    q->nproc = 0;
+    q->nrun = 0;
+    q->elapsed = 0;
+    q->ticks = 0;
+}
+
 void
 sched_init(void)
 {
@@ -148,6 +627,8 @@ sched_init(void)
         panic("sched_init: could not get core\n");
     }
 
-    TAILQ_INIT(&core->scq.q);
+    sched_queue_init(&core->scq, core);
+    callout_wheel_init(&core->wheel);
+    wchan_init();
     printf("sched: scheduler is [up]\n");
 }
@@ -30,22 +30,74 @@
 #include <sys/syscall.h>
 #include <sys/errno.h>
 #include <sys/cdefs.h>
+#include <sys/cpuvar.h>
+#include <sys/proc.h>
 #include <os/clkdev.h>
+#include <os/callout.h>
+#include <os/wchan.h>
 #include <os/sleep.h>
 
 static struct clkdev *clk = NULL;
 
+/*
+ * Sleep timer callout
+ *
+ * @arg: Process to wake up
+ */
+static void
+usleep_wake(void *arg)
+{
+    struct proc *proc = arg;
+
+    wchan_wakeup(&proc->sleep_timer);
+}
+
+/*
+ * Put the current process to sleep for a number of
+ * usecs
+ */
+int
+proc_usleep(size_t usec)
+{
+    struct proc *self = proc_self();
+    uint64_t intr;
+    int error;
+
+    if (self == NULL) {
+        return -ESRCH;
+    }
+
+    /*
+     * The callout goes on our own wheel and the wheel
+     * only runs from the timer, it cannot beat us to
+     * the sleep queue with interrupts off.
+     */
+    intr = md_intr_save();
+    error = callout_reset(&self->sleep_timer, usec, usleep_wake, self);
+    if (error == 0) {
+        wchan_sleep(&self->sleep_timer, NULL);
+    }
+
+    md_intr_restore(intr);
+    return error;
+}
+
 scret_t
 sys_usleep(struct syscall_args *scargs)
 {
     uint32_t usec = SCARG(scargs, uint32_t, 0);
 
+    if (usec == 0)
+        return 0;
+    if (proc_usleep(usec) == 0)
+        return 0;
+
+    /* No timer to wait on, spin on the clock instead */
     if (clk == NULL)
         clkdev_get(CLKDEV_GET_USEC | CLKDEV_MSLEEP, &clk);
     if (__unlikely(clk == NULL))
         return -EIO;
 
-    /* TODO: Suspend the calling thread */
     clk->usleep(usec);
     return 0;
 }
@@ -29,6 +29,7 @@
 
 #include <sys/proc.h>
 #include <sys/errno.h>
+#include <sys/mman.h>
 #include <os/systm.h>
 #include <string.h>
 
@@ -53,7 +54,7 @@ copyin(const void *uaddr, void *kaddr, size_t len)
         return -EIO;
     }
 
-    error = proc_check_addr(self, (uintptr_t)uaddr, len);
+    error = proc_check_addr(self, (uintptr_t)uaddr, len, PROT_READ);
     if (error < 0) {
         return error;
     }
@@ -83,7 +84,7 @@ copyout(const void *kaddr, void *uaddr, size_t len)
         return -EIO;
     }
 
-    error = proc_check_addr(self, (uintptr_t)uaddr, len);
+    error = proc_check_addr(self, (uintptr_t)uaddr, len, PROT_WRITE);
     if (error < 0) {
         return error;
     }
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Description: Wait channels
+ * Author: Ian Marco Moffett
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/cpuvar.h>
+#include <sys/proc.h>
+#include <os/sched.h>
+#include <os/wchan.h>
+
+/*
+ * Sleeping processes are kept here rather than on the
+ * runqueues so the scheduler never has to look at them,
+ * a wakeup only has to go through the processes that
+ * share a sleep queue with the channel.
+ */
+static struct sleepq sleepq_tab[WCHAN_NBUCKET];
+
+/*
+ * Get the sleep queue a wait channel hashes to
+ *
+ * @chan: Wait channel to look up
+ */
+static inline struct sleepq *
+wchan_sleepq(const void *chan)
+{
+    uint64_t hash;
+
+    /* Fibonacci hashing, low bits are mostly alignment */
+    hash = ((uintptr_t)chan >> 4) * 0x9E3779B97F4A7C15ULL;
+    return &sleepq_tab[hash >> (64 - WCHAN_SHIFT)];
+}
+
+/*
+ * Put the current process to sleep on a channel
+ */
+void
+wchan_sleep(const void *chan, struct spinlock *lock)
+{
+    struct proc *self = proc_self();
+    struct sleepq *sq;
+    uint64_t intr;
+
+    if (self == NULL || chan == NULL) {
+        if (lock != NULL)
+            spinlock_release(lock);
+        return;
+    }
+
+    /*
+     * The switch path takes the sleep queue lock, keep
+     * the timer from coming in while we hold it.
+     */
+    sq = wchan_sleepq(chan);
+    intr = md_intr_save();
+    spinlock_acquire(&sq->lock);
+    self->wchan = chan;
+    self->flags |= PROC_SLEEPING;
+    TAILQ_INSERT_TAIL(&sq->q, self, link);
+
+    /* Anyone changing the condition must wake us now */
+    if (lock != NULL) {
+        spinlock_release(lock);
+    }
+
+    spinlock_release(&sq->lock);
+    md_intr_restore(intr);
+    md_proc_yield();
+}
+
+/*
+ * Wake up everything sleeping on a channel
+ */
+size_t
+wchan_wakeup(const void *chan)
+{
+    TAILQ_HEAD(, proc) runq;
+    struct proc *proc, *tmp;
+    struct pcore *core;
+    struct sleepq *sq;
+    size_t nwoken = 0;
+    uint64_t intr;
+
+    if (chan == NULL) {
+        return 0;
+    }
+
+    TAILQ_INIT(&runq);
+    sq = wchan_sleepq(chan);
+    intr = md_intr_save();
+    spinlock_acquire(&sq->lock);
+    TAILQ_FOREACH_SAFE(proc, &sq->q, link, tmp) {
+        if (proc->wchan != chan)
+            continue;
+
+        TAILQ_REMOVE(&sq->q, proc, link);
+        proc->wchan = NULL;
+        proc->flags &= ~PROC_SLEEPING;
+        sched_boost(proc);
+        ++nwoken;
+
+        /*
+         * If it has not been switched away from yet its
+         * core queues it like any other process.
+         */
+        if (ISSET(proc->flags, PROC_PARKED)) {
+            proc->flags &= ~PROC_PARKED;
+            TAILQ_INSERT_TAIL(&runq, proc, link);
+        }
+    }
+    spinlock_release(&sq->lock);
+
+    /* Back to where their caches are warm */
+    while ((proc = TAILQ_FIRST(&runq)) != NULL) {
+        TAILQ_REMOVE(&runq, proc, link);
+        if ((core = proc->core) == NULL) {
+            core = cpu_sched();
+        }
+
+        sched_enq(&core->scq, proc);
+    }
+
+    md_intr_restore(intr);
+    return nwoken;
+}
+
+/*
+ * Park a process that is being switched away from
+ */
+bool
+wchan_park(struct proc *proc)
+{
+    const void *chan;
+    struct sleepq *sq;
+    bool parked = false;
+
+    if (proc == NULL || (chan = proc->wchan) == NULL) {
+        return false;
+    }
+
+    /*
+     * Only we may put the process to sleep but anyone may
+     * wake it up, check again under the lock.
+     */
+    sq = wchan_sleepq(chan);
+    spinlock_acquire(&sq->lock);
+    if (proc->wchan == chan) {
+        proc->flags |= PROC_PARKED;
+        parked = true;
+    }
+
+    spinlock_release(&sq->lock);
+    return parked;
+}
+
+void
+wchan_init(void)
+{
+    for (int i = 0; i < WCHAN_NBUCKET; ++i) {
+        TAILQ_INIT(&sleepq_tab[i].q);
+        sleepq_tab[i].lock.lock = 0;
+    }
+}
@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Description: Per-core workqueues
+ * Author: Ian Marco Moffett
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/errno.h>
+#include <sys/queue.h>
+#include <sys/atomic.h>
+#include <sys/limits.h>
+#include <sys/syslog.h>
+#include <sys/panic.h>
+#include <sys/cpuvar.h>
+#include <sys/proc.h>
+#include <os/workq.h>
+#include <os/wchan.h>
+#include <string.h>
+#include <stdbool.h>
+
+static struct workq workq_tab[CPU_MAX];
+static bool is_workq_up = false;
+
+/*
+ * Get the queue of a core
+ *
+ * @core: Core to get the queue of
+ */
+static inline struct workq *
+core_workq(struct pcore *core)
+{
+    return &workq_tab[core->id];
+}
+
+/*
+ * Put claimed work on the queue it was claimed for
+ * and let the worker know.
+ *
+ * @wq: Queue to use
+ * @wp: Work to insert
+ *
+ * XXX: Interrupts must be masked
+ */
+static void
+workq_insert(struct workq *wq, struct work *wp)
+{
+    spinlock_acquire(&wq->lock);
+    wp->flags |= WORK_QUEUED;
+    TAILQ_INSERT_TAIL(&wq->q, wp, link);
+    spinlock_release(&wq->lock);
+    wchan_wakeup(wq);
+}
+
+/*
+ * Delayed work timer, this runs on the core the work
+ * was queued on.
+ *
+ * @arg: Work that is due
+ */
+static void
+work_timeout(void *arg)
+{
+    struct work *wp = arg;
+    struct workq *wq;
+
+    if ((wq = wp->wq) == NULL) {
+        return;
+    }
+
+    /* It may have been cancelled before we got here */
+    spinlock_acquire(&wq->lock);
+    if (wp->wq != wq || !ISSET(wp->flags, WORK_DELAYED)) {
+        spinlock_release(&wq->lock);
+        return;
+    }
+
+    wp->flags &= ~WORK_DELAYED;
+    wp->flags |= WORK_QUEUED;
+    TAILQ_INSERT_TAIL(&wq->q, wp, link);
+    spinlock_release(&wq->lock);
+    wchan_wakeup(wq);
+}
+
+/*
+ * Claim work for the queue of the current core
+ *
+ * @wp: Work to claim
+ * @wq_res: Queue it was claimed for is written here
+ *
+ * Returns zero on success
+ *
+ * XXX: Interrupts must be masked
+ */
+static int
+work_claim(struct work *wp, struct workq **wq_res)
+{
+    struct pcore *core;
+    struct workq *wq;
+
+    if (!is_workq_up) {
+        return -ENXIO;
+    }
+
+    if ((core = this_core()) == NULL) {
+        return -ENXIO;
+    }
+
+    wq = core_workq(core);
+    if (atomic_cas_ptr(&wp->wq, NULL, wq) != NULL) {
+        return -EALREADY;
+    }
+
+    wp->owner = wq;
+    *wq_res = wq;
+    return 0;
+}
+
+static void
+workq_main(void *arg)
+{
+    struct workq *wq;
+    struct work *wp;
+    uint64_t intr;
+
+    /* We are bound to this core, so is its queue */
+    wq = core_workq(this_core());
+    for (;;) {
+        intr = md_intr_save();
+        spinlock_acquire(&wq->lock);
+        if ((wp = TAILQ_FIRST(&wq->q)) == NULL) {
+            wchan_sleep(wq, &wq->lock);
+            md_intr_restore(intr);
+            continue;
+        }
+
+        /* It may be queued again once it is off */
+        TAILQ_REMOVE(&wq->q, wp, link);
+        wp->flags &= ~WORK_QUEUED;
+        wp->wq = NULL;
+        wq->current = wp;
+        spinlock_release(&wq->lock);
+        md_intr_restore(intr);
+
+        wp->fn(wp->arg);
+
+        intr = md_intr_save();
+        spinlock_acquire(&wq->lock);
+        wq->current = NULL;
+        spinlock_release(&wq->lock);
+        md_intr_restore(intr);
+
+        /* Anyone flushing it may go on now */
+        wchan_wakeup(wp);
+    }
+}
+
+/*
+ * Initialize a work item
+ */
+void
+work_init(struct work *wp, void(*fn)(void *), void *arg)
+{
+    if (wp == NULL) {
+        return;
+    }
+
+    memset(wp, 0, sizeof(*wp));
+    wp->fn = fn;
+    wp->arg = arg;
+}
+
+/*
+ * Queue work on the current core
+ */
+int
+work_queue(struct work *wp)
+{
+    struct workq *wq;
+    uint64_t intr;
+    int error;
+
+    if (wp == NULL || wp->fn == NULL) {
+        return -EINVAL;
+    }
+
+    intr = md_intr_save();
+    if ((error = work_claim(wp, &wq)) == 0) {
+        workq_insert(wq, wp);
+    }
+
+    md_intr_restore(intr);
+    return error;
+}
+
+/*
+ * Queue work after a delay
+ */
+int
+work_queue_delayed(struct work *wp, size_t usec)
+{
+    struct workq *wq;
+    uint64_t intr;
+    int error;
+
+    if (wp == NULL || wp->fn == NULL) {
+        return -EINVAL;
+    }
+
+    /*
+     * The timer goes on the wheel of this core, with
+     * interrupts masked it cannot go off before we are
+     * done here.
+     */
+    intr = md_intr_save();
+    if ((error = work_claim(wp, &wq)) < 0) {
+        md_intr_restore(intr);
+        return error;
+    }
+
+    spinlock_acquire(&wq->lock);
+    wp->flags |= WORK_DELAYED;
+    spinlock_release(&wq->lock);
+
+    error = callout_reset(&wp->timer, usec, work_timeout, wp);
+    if (error < 0) {
+        spinlock_acquire(&wq->lock);
+        wp->flags &= ~WORK_DELAYED;
+        wp->wq = NULL;
+        spinlock_release(&wq->lock);
+    }
+
+    md_intr_restore(intr);
+    return error;
+}
+
+/*
+ * Cancel pending work
+ */
+int
+work_cancel(struct work *wp)
+{
+    struct workq *wq;
+    uint64_t intr;
+
+    if (wp == NULL) {
+        return -EINVAL;
+    }
+
+    if ((wq = wp->wq) == NULL) {
+        return -ESRCH;
+    }
+
+    intr = md_intr_save();
+    spinlock_acquire(&wq->lock);
+
+    /* The worker may have taken it already */
+    if (wp->wq != wq) {
+        spinlock_release(&wq->lock);
+        md_intr_restore(intr);
+        return -ESRCH;
+    }
+
+    if (ISSET(wp->flags, WORK_DELAYED)) {
+        callout_stop(&wp->timer);
+    }
+    if (ISSET(wp->flags, WORK_QUEUED)) {
+        TAILQ_REMOVE(&wq->q, wp, link);
+    }
+
+    wp->flags = 0;
+    wp->wq = NULL;
+    spinlock_release(&wq->lock);
+    md_intr_restore(intr);
+    return 0;
+}
+
+/*
+ * Wait on work to be done
+ */
+int
+work_flush(struct work *wp)
+{
+    struct proc *self = proc_self();
+    struct workq *wq;
+    uint64_t intr;
+    bool busy;
+
+    if (wp == NULL) {
+        return -EINVAL;
+    }
+
+    if (self == NULL || !ISSET(self->flags, PROC_KTD)) {
+        return -EPERM;
+    }
+
+    for (;;) {
+        if ((wq = wp->owner) == NULL) {
+            return 0;
+        }
+
+        intr = md_intr_save();
+        spinlock_acquire(&wq->lock);
+
+        /* Being queued elsewhere, catch it over there */
+        if (wp->owner != wq || (wp->wq != NULL && wp->wq != wq)) {
+            spinlock_release(&wq->lock);
+            md_intr_restore(intr);
+            md_spinwait();
+            continue;
+        }
+
+        busy = (wp->wq == wq || wq->current == wp);
+        if (!busy) {
+            spinlock_release(&wq->lock);
+            md_intr_restore(intr);
+            return 0;
+        }
+
+        /* The worker wakes us once it is done with it */
+        wchan_sleep(wp, &wq->lock);
+        md_intr_restore(intr);
+    }
+}
+
+/*
+ * Start the worker threads
+ */
+void
+workq_init(void)
+{
+    struct workq *wq;
+    struct pcore *core;
+    size_t ncores = cpu_count();
+    int error;
+
+    for (size_t i = 0; i < ncores; ++i) {
+        if ((core = cpu_get(i)) == NULL)
+            continue;
+
+        wq = core_workq(core);
+        TAILQ_INIT(&wq->q);
+        wq->lock.lock = 0;
+        wq->current = NULL;
+
+        error = proc_bound_td(core, &wq->td, workq_main);
+        if (error < 0) {
+            panic("workq: could not start worker for core %d\n", core->id);
+        }
+    }
+
+    is_workq_up = true;
+    printf("workq: %d worker(s) [up]\n", ncores);
+}
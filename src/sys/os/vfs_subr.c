@@ -31,10 +31,16 @@
 #include <sys/errno.h>
 #include <sys/atomic.h>
 #include <os/vnode.h>
-#include <os/kalloc.h>
 #include <os/vfs.h>
+#include <vm/kmem.h>
 #include <string.h>
 
+static struct kmem_cache vnode_cache = KMEM_CACHE_INIT(
+    "vnode",
+    sizeof(struct vnode),
+    NULL
+);
+
 /*
  * Returns a value of zero if a character value
  * within a path is valid, otherwise a less than
@@ -72,7 +78,7 @@ vfs_valloc(struct vnode **resp, vtype_t type, int flags)
     }
 
     /* Attempt to allocate a vnode */
-    vp = kalloc(sizeof(*vp));
+    vp = kmem_cache_alloc(&vnode_cache);
     if (vp == NULL) {
         return -ENOMEM;
     }
@@ -94,7 +100,7 @@ vfs_vrel(struct vnode *vp, int flags)
     if (atomic_dec_int(&vp->refcount) > 1) {
         return 0;
     }
-    kfree(vp);
+    kmem_cache_free(&vnode_cache, vp);
     return 0;
 }
 
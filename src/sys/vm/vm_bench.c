@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Description: Frame allocator latency benchmark
+ * Author: Ian Marco Moffett
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/syslog.h>
+#include <sys/cpuvar.h>
+#include <vm/physseg.h>
+#include <vm/vm.h>
+
+#define pr_trace(fmt, ...) printf("vm_bench: " fmt, ##__VA_ARGS__)
+
+/*
+ * Number of single frames to use when fragmenting
+ * the heap, every other one gets freed to create
+ * holes.
+ */
+#define BENCH_NFRAMES   4096
+
+/* Number of frames per multi-frame allocation */
+#define BENCH_BLKSIZE   16
+
+/* Number of multi-frame allocations to time */
+#define BENCH_NBLK      64
+
+/*
+ * Time a frame allocation
+ *
+ * @count: Number of frames to allocate
+ * @total: Cycles spent are added here
+ */
+static paddr_t
+bench_alloc(size_t count, uint64_t *total)
+{
+    uint64_t start;
+    paddr_t pa;
+
+    start = md_cycles();
+    pa = vm_alloc_frame(count);
+    *total += md_cycles() - start;
+    return pa;
+}
+
+/*
+ * Time a frame free
+ *
+ * @pa: Base of the frames to free
+ * @count: Number of frames to free
+ * @total: Cycles spent are added here
+ */
+static void
+bench_free(paddr_t pa, size_t count, uint64_t *total)
+{
+    uint64_t start;
+
+    start = md_cycles();
+    vm_free_frame(pa, count);
+    *total += md_cycles() - start;
+}
+
+/*
+ * Fragment the heap by allocating a run of single
+ * frames and freeing every other one, then measure
+ * allocation and free latency on top of it.
+ */
+void
+vm_bench_frames(void)
+{
+    struct pcore *core = this_core();
+    const size_t TAB_PAGES = BYTES_TO_PAGES(sizeof(paddr_t) * BENCH_NFRAMES);
+    paddr_t blocks[BENCH_NBLK];
+    uint64_t alloc_cycles = 0;
+    uint64_t free_cycles = 0;
+    size_t nholes = BENCH_NFRAMES / 2;
+    paddr_t tab_pa, *frames;
+
+    tab_pa = vm_alloc_frame(TAB_PAGES);
+    if (tab_pa == 0) {
+        pr_trace("could not allocate frame table\n");
+        return;
+    }
+
+    /* Fragment the heap */
+    frames = PHYS_TO_VIRT(tab_pa);
+    for (size_t i = 0; i < BENCH_NFRAMES; ++i) {
+        frames[i] = vm_alloc_frame(1);
+    }
+    for (size_t i = 1; i < BENCH_NFRAMES; i += 2) {
+        vm_free_frame(frames[i], 1);
+    }
+
+    pr_trace("heap fragmented [order-0 blocks: %d]\n", vm_seg_nfree(0));
+
+    /* Single frames fill the holes */
+    for (size_t i = 1; i < BENCH_NFRAMES; i += 2) {
+        frames[i] = bench_alloc(1, &alloc_cycles);
+    }
+    for (size_t i = 1; i < BENCH_NFRAMES; i += 2) {
+        bench_free(frames[i], 1, &free_cycles);
+    }
+
+    pr_trace(
+        "order-0: alloc=%d cycles, free=%d cycles\n",
+        alloc_cycles / nholes,
+        free_cycles / nholes
+    );
+
+    /* Multi-frame blocks must skip over the holes */
+    alloc_cycles = 0;
+    free_cycles = 0;
+    for (size_t i = 0; i < BENCH_NBLK; ++i) {
+        blocks[i] = bench_alloc(BENCH_BLKSIZE, &alloc_cycles);
+    }
+    for (size_t i = 0; i < BENCH_NBLK; ++i) {
+        bench_free(blocks[i], BENCH_BLKSIZE, &free_cycles);
+    }
+
+    pr_trace(
+        "%d frames: alloc=%d cycles, free=%d cycles\n",
+        BENCH_BLKSIZE,
+        alloc_cycles / BENCH_NBLK,
+        free_cycles / BENCH_NBLK
+    );
+
+    /* Give everything back */
+    for (size_t i = 0; i < BENCH_NFRAMES; i += 2) {
+        vm_free_frame(frames[i], 1);
+    }
+
+    vm_free_frame(tab_pa, TAB_PAGES);
+    if (core != NULL) {
+        pr_trace(
+            "pcache: hits=%d, misses=%d\n",
+            core->pcache.hits,
+            core->pcache.misses
+        );
+    }
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Description: Demand paging, copy-on-write and stack growth
+ * Author: Ian Marco Moffett
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/errno.h>
+#include <sys/queue.h>
+#include <sys/proc.h>
+#include <sys/mman.h>
+#include <os/spinlock.h>
+#include <vm/physseg.h>
+#include <vm/fault.h>
+#include <vm/mmu.h>
+#include <vm/range.h>
+#include <vm/vm.h>
+#include <string.h>
+
+/* From kconf */
+#if defined(__VM_FAULT_AROUND)
+#define VM_FAULT_AROUND __VM_FAULT_AROUND
+#else
+#define VM_FAULT_AROUND 0
+#endif
+
+/*
+ * Back a single page with a fresh zeroed frame
+ *
+ * @vas: Address space to map into
+ * @va: Page base to map
+ * @prot: Protection flags (PROT_*)
+ */
+static int
+vm_fault_page(struct vm_vas *vas, vaddr_t va, int prot)
+{
+    struct mmu_map spec;
+    int error;
+
+    spec.va = va;
+    spec.pa = vm_alloc_frame_flags(1, VM_ALLOC_TRY);
+    if (spec.pa == 0) {
+        return -ENOMEM;
+    }
+
+    error = mmu_map_single(vas, &spec, prot);
+    if (error < 0) {
+        vm_free_frame(spec.pa, 1);
+    }
+
+    return error;
+}
+
+/*
+ * Give a process its own copy of a page that it
+ * shares with others since fork().
+ *
+ * @vas: Address space of the process
+ * @va: Page base that was written to
+ * @pa: Frame currently mapped at `va'
+ * @prot: Protection flags of the range (PROT_*)
+ */
+static int
+vm_cow_break(struct vm_vas *vas, vaddr_t va, paddr_t pa, int prot)
+{
+    struct mmu_map spec;
+    int error;
+
+    /* If everyone else let go, it's ours to write */
+    spec.va = va;
+    if (!vm_frame_shared(pa)) {
+        spec.pa = pa;
+        return mmu_map_single(vas, &spec, prot);
+    }
+
+    spec.pa = vm_alloc_frame_flags(1, VM_ALLOC_NOZERO | VM_ALLOC_TRY);
+    if (spec.pa == 0) {
+        return -ENOMEM;
+    }
+
+    memcpy(PHYS_TO_VIRT(spec.pa), PHYS_TO_VIRT(pa), DEFAULT_PAGESIZE);
+    error = mmu_map_single(vas, &spec, prot);
+    if (error < 0) {
+        vm_free_frame(spec.pa, 1);
+        return error;
+    }
+
+    vm_frame_unref(pa);
+    return 0;
+}
+
+struct vm_range *
+vm_stack_grow(struct proc *procp, vaddr_t va)
+{
+    const vaddr_t LIMIT = (STACK_TOP + 1) - STACK_MAX;
+    struct vm_range *range, *stack = NULL;
+    vaddr_t base;
+
+    if (procp == NULL || va < LIMIT || va > STACK_TOP) {
+        return NULL;
+    }
+
+    /* The stack always ends at the top */
+    stack = vm_range_find(&procp->maplist, STACK_TOP);
+    if (stack == NULL || !ISSET(stack->flags, VM_RANGE_STACK)) {
+        return NULL;
+    }
+    if (va >= stack->va_base) {
+        return NULL;
+    }
+
+    /* Don't grow into anything else */
+    base = ALIGN_DOWN(va, DEFAULT_PAGESIZE);
+    range = RB_PREV(vm_range_tree, &procp->maplist, stack);
+    if (range != NULL && (range->va_base + range->len) > base) {
+        return NULL;
+    }
+
+    stack->len += stack->va_base - base;
+    stack->va_base = base;
+    vm_range_fixup(stack);
+    return stack;
+}
+
+int
+vm_fault(struct proc *procp, vaddr_t va, int access)
+{
+    const size_t PSIZE = DEFAULT_PAGESIZE;
+    struct vm_range *range;
+    struct vm_vas *vas;
+    vaddr_t start, end;
+    paddr_t pa;
+    ssize_t step;
+    int error;
+
+    if (procp == NULL) {
+        return -EINVAL;
+    }
+
+    vas = &procp->pcb.vas;
+    va = ALIGN_DOWN(va, PSIZE);
+
+    spinlock_acquire(&procp->maplist_lock);
+    if ((range = proc_find_range(procp, va)) == NULL) {
+        range = vm_stack_grow(procp, va);
+    }
+
+    /* Only lazy ranges are backed on demand */
+    if (range == NULL || !ISSET(range->flags, VM_RANGE_LAZY)) {
+        error = -EFAULT;
+        goto done;
+    }
+
+    if (ISSET(access, ~range->prot & (PROT_WRITE | PROT_EXEC))) {
+        error = -EACCES;
+        goto done;
+    }
+
+    /*
+     * If the page is already there then this is either
+     * a write to a copy-on-write page, a bad access or
+     * someone beat us to it.
+     */
+    if (mmu_translate(vas, va, &pa) == 0) {
+        if (ISSET(access, PROT_WRITE) && ISSET(range->prot, PROT_WRITE)) {
+            error = vm_cow_break(vas, va, pa, range->prot);
+        } else {
+            error = ISSET(access, VM_FAULT_PRESENT) ? -EACCES : 0;
+        }
+        goto done;
+    }
+
+    if ((error = vm_fault_page(vas, va, range->prot)) < 0) {
+        goto done;
+    }
+
+    /*
+     * Map a few more pages in the direction the range
+     * is likely to be walked in, stacks grow down and
+     * everything else is assumed to be read forward.
+     */
+    start = range->va_base;
+    end = start + range->len;
+    step = ISSET(range->flags, VM_RANGE_STACK) ? -(ssize_t)PSIZE : PSIZE;
+    for (int i = 0; i < VM_FAULT_AROUND; ++i) {
+        va += step;
+        if (va < start || va >= end)
+            break;
+        if (mmu_translate(vas, va, &pa) == 0)
+            break;
+        if (vm_fault_page(vas, va, range->prot) < 0)
+            break;
+    }
+
+done:
+    spinlock_release(&procp->maplist_lock);
+    return error;
+}
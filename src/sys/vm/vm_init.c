@@ -29,12 +29,23 @@
 
 #include <sys/panic.h>
 #include <sys/cpuvar.h>
+#include <sys/syslog.h>
+#include <sys/proc.h>
 #include <os/kalloc.h>
+#include <os/module.h>
+#include <acpi/acpi.h>
 #include <vm/vm.h>
 #include <vm/mmu.h>
 #include <vm/physseg.h>
 
 
+/* From kconf */
+#if defined(__VM_BENCH)
+#define VM_BENCH __VM_BENCH
+#else
+#define VM_BENCH 0
+#endif
+
 /* os_kalloc.c */
 void __kalloc_init(void);
 
@@ -55,4 +66,67 @@ vm_init(void)
     }
 
     __kalloc_init();
+
+    /* Should we benchmark the frame allocator? */
+    if (VM_BENCH) {
+        vm_bench_frames();
+    }
 }
+
+/*
+ * Late boot memory reclaim, by the time this runs every
+ * core must be off of the stack the bootloader gave it
+ * and nothing may touch bootloader responses anymore.
+ */
+static void
+vm_reclaim_main(void *arg)
+{
+    struct proc *self = proc_self();
+    struct pcore *core;
+    uintptr_t *keep;
+    paddr_t pa;
+    size_t n, npages;
+
+    for (size_t i = 0; i < cpu_count(); ++i) {
+        core = cpu_get(i);
+        while (!core->booted) {
+            md_spinwait();
+        }
+    }
+
+    if (acpi_copy_tables() < 0) {
+        printf("vm_reclaim: could not copy ACPI tables\n");
+        goto done;
+    }
+
+    /*
+     * The bootloader built the kernel page tables within
+     * memory we are reclaiming, those stay where they are.
+     */
+    n = mmu_kvas_tables(NULL, 0);
+    npages = ALIGN_UP(n * sizeof(*keep), DEFAULT_PAGESIZE) / DEFAULT_PAGESIZE;
+    pa = vm_alloc_frame(npages);
+    keep = PHYS_TO_VIRT(pa);
+    if (mmu_kvas_tables(keep, n) != n) {
+        printf("vm_reclaim: kernel page tables changed\n");
+        vm_free_frame(pa, npages);
+        goto done;
+    }
+
+    vm_seg_reclaim(&stat, keep, n);
+    vm_free_frame(pa, npages);
+done:
+    for (;;) {
+        proc_sleep(self);
+    }
+}
+
+static int
+vm_reclaim_init(struct module *modp)
+{
+    struct proc *td;
+
+    return proc_ktd(&td, vm_reclaim_main);
+}
+
+MODULE_EXPORT("vm_reclaim", MODTYPE_GENERIC, vm_reclaim_init);
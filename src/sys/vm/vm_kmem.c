@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Description: Slab allocator for fixed size kernel objects
+ * Author: Ian Marco Moffett
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/limits.h>
+#include <sys/syslog.h>
+#include <sys/cpuvar.h>
+#include <os/spinlock.h>
+#include <vm/kmem.h>
+#include <vm/physseg.h>
+#include <vm/vm.h>
+#include <string.h>
+
+/* Object alignment */
+#define KMEM_ALIGN 16
+
+/* Minimum number of objects per slab */
+#define KMEM_MIN_OBJS 8
+
+/*
+ * A slab is a naturally aligned block of frames with
+ * this header at the start followed by the objects.
+ * Since the block is naturally aligned, the header of
+ * any object can be found by aligning down.
+ *
+ * @link: Partial / full list link
+ * @cache: Cache this slab belongs to
+ * @objbase: Address of the first object
+ * @nfree: Number of free objects
+ * @freestk: Stack of free object indices
+ */
+struct kmem_slab {
+    TAILQ_ENTRY(kmem_slab) link;
+    struct kmem_cache *cache;
+    uintptr_t objbase;
+    size_t nfree;
+    uint16_t freestk[];
+};
+
+/*
+ * Get the offset of the first object within a
+ * slab holding `nobjs' objects.
+ */
+static inline size_t
+kmem_objoff(size_t nobjs)
+{
+    size_t off;
+
+    off = sizeof(struct kmem_slab) + (nobjs * sizeof(uint16_t));
+    return ALIGN_UP(off, KMEM_ALIGN);
+}
+
+/*
+ * Get the slab an object lives in
+ *
+ * @cp: Cache of object
+ * @obj: Object to look up
+ */
+static inline struct kmem_slab *
+kmem_obj_slab(struct kmem_cache *cp, void *obj)
+{
+    size_t slab_size = cp->slab_pages * DEFAULT_PAGESIZE;
+
+    return (void *)ALIGN_DOWN((uintptr_t)obj, slab_size);
+}
+
+/*
+ * Get the magazine of the current core
+ *
+ * Returns NULL if this core is not set up yet
+ *
+ * XXX: Interrupts must be masked
+ */
+static inline struct kmem_mag *
+kmem_mag_get(struct kmem_cache *cp)
+{
+    struct pcore *core;
+
+    if ((core = this_core()) == NULL) {
+        return NULL;
+    }
+
+    return &cp->mags[core->id];
+}
+
+/*
+ * Set up the slab geometry and magazines of
+ * a cache.
+ *
+ * @cp: Cache to set up
+ */
+static void
+kmem_cache_setup(struct kmem_cache *cp)
+{
+    size_t slab_size, nobjs;
+    size_t mag_pages;
+    paddr_t mags;
+
+    spinlock_acquire(&cp->lock);
+    if (cp->is_init) {
+        spinlock_release(&cp->lock);
+        return;
+    }
+
+    /* Find the smallest slab that fits enough objects */
+    cp->objsize = ALIGN_UP(MAX(cp->objsize, 1), KMEM_ALIGN);
+    for (cp->slab_pages = 1;; cp->slab_pages <<= 1) {
+        slab_size = cp->slab_pages * DEFAULT_PAGESIZE;
+        nobjs = slab_size / (cp->objsize + sizeof(uint16_t));
+        while (kmem_objoff(nobjs) + (nobjs * cp->objsize) > slab_size) {
+            --nobjs;
+        }
+
+        if (nobjs >= KMEM_MIN_OBJS)
+            break;
+    }
+
+    mag_pages = BYTES_TO_PAGES(sizeof(struct kmem_mag) * CPU_MAX);
+    mags = vm_alloc_frame(mag_pages);
+
+    cp->nobjs = nobjs;
+    cp->mags = PHYS_TO_VIRT(mags);
+    cp->empty = NULL;
+    TAILQ_INIT(&cp->partial);
+    TAILQ_INIT(&cp->full);
+    cp->is_init = true;
+    spinlock_release(&cp->lock);
+}
+
+/*
+ * Create a new slab for a cache
+ *
+ * @cp: Cache to create slab for
+ *
+ * Returns NULL on failure
+ */
+static struct kmem_slab *
+kmem_slab_create(struct kmem_cache *cp)
+{
+    struct kmem_slab *slab;
+    paddr_t pa;
+
+    pa = vm_alloc_frame_flags(cp->slab_pages, VM_ALLOC_NOZERO);
+    if (pa == 0) {
+        return NULL;
+    }
+
+    slab = PHYS_TO_VIRT(pa);
+    slab->cache = cp;
+    slab->objbase = (uintptr_t)slab + kmem_objoff(cp->nobjs);
+    slab->nfree = cp->nobjs;
+
+    /* Lowest indices get handed out first */
+    for (size_t i = 0; i < cp->nobjs; ++i) {
+        slab->freestk[i] = cp->nobjs - i - 1;
+        if (cp->ctor != NULL) {
+            cp->ctor((void *)(slab->objbase + (i * cp->objsize)));
+        }
+    }
+
+    return slab;
+}
+
+/*
+ * Allocate an object from the slab layer
+ *
+ * XXX: Cache lock must be held
+ */
+static void *
+kmem_slab_alloc(struct kmem_cache *cp)
+{
+    struct kmem_slab *slab;
+    uint16_t idx;
+
+    if ((slab = TAILQ_FIRST(&cp->partial)) == NULL) {
+        if ((slab = cp->empty) != NULL) {
+            cp->empty = NULL;
+        } else {
+            slab = kmem_slab_create(cp);
+        }
+
+        if (slab == NULL) {
+            return NULL;
+        }
+
+        TAILQ_INSERT_HEAD(&cp->partial, slab, link);
+    }
+
+    idx = slab->freestk[--slab->nfree];
+    if (slab->nfree == 0) {
+        TAILQ_REMOVE(&cp->partial, slab, link);
+        TAILQ_INSERT_HEAD(&cp->full, slab, link);
+    }
+
+    return (void *)(slab->objbase + (idx * cp->objsize));
+}
+
+/*
+ * Return an object to the slab layer
+ *
+ * XXX: Cache lock must be held
+ */
+static void
+kmem_slab_free(struct kmem_cache *cp, void *obj)
+{
+    struct kmem_slab *slab = kmem_obj_slab(cp, obj);
+    size_t idx;
+
+    idx = ((uintptr_t)obj - slab->objbase) / cp->objsize;
+    if (slab->nfree++ == 0) {
+        TAILQ_REMOVE(&cp->full, slab, link);
+        TAILQ_INSERT_HEAD(&cp->partial, slab, link);
+    }
+
+    slab->freestk[slab->nfree - 1] = idx;
+    if (slab->nfree < cp->nobjs) {
+        return;
+    }
+
+    /* Keep one empty slab around, give the rest back */
+    TAILQ_REMOVE(&cp->partial, slab, link);
+    if (cp->empty == NULL) {
+        cp->empty = slab;
+        return;
+    }
+
+    vm_free_frame(VIRT_TO_PHYS(slab), cp->slab_pages);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *cp)
+{
+    struct kmem_mag *mag;
+    void *obj = NULL;
+    uint64_t intr;
+
+    if (cp == NULL) {
+        return NULL;
+    }
+
+    intr = md_intr_save();
+    if (!cp->is_init) {
+        kmem_cache_setup(cp);
+    }
+
+    /* Fast path, grab one from our magazine */
+    mag = kmem_mag_get(cp);
+    if (mag != NULL && mag->count > 0) {
+        obj = mag->objs[--mag->count];
+        md_intr_restore(intr);
+        return obj;
+    }
+
+    spinlock_acquire(&cp->lock);
+    if (mag == NULL) {
+        obj = kmem_slab_alloc(cp);
+        goto done;
+    }
+
+    /* Refill half of the magazine */
+    while (mag->count < KMEM_MAG_SIZE / 2) {
+        if ((obj = kmem_slab_alloc(cp)) == NULL)
+            break;
+
+        mag->objs[mag->count++] = obj;
+    }
+
+    obj = NULL;
+    if (mag->count > 0) {
+        obj = mag->objs[--mag->count];
+    }
+done:
+    spinlock_release(&cp->lock);
+    md_intr_restore(intr);
+    return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *cp, void *obj)
+{
+    struct kmem_mag *mag;
+    struct kmem_slab *slab;
+    uint64_t intr;
+
+    if (cp == NULL || obj == NULL) {
+        return;
+    }
+
+    slab = kmem_obj_slab(cp, obj);
+    if (!cp->is_init || slab->cache != cp) {
+        printf("kmem: %p not from cache \"%s\"\n", obj, cp->name);
+        return;
+    }
+
+    /* Fast path, put it in our magazine */
+    intr = md_intr_save();
+    mag = kmem_mag_get(cp);
+    if (mag != NULL && mag->count < KMEM_MAG_SIZE) {
+        mag->objs[mag->count++] = obj;
+        md_intr_restore(intr);
+        return;
+    }
+
+    spinlock_acquire(&cp->lock);
+    if (mag == NULL) {
+        kmem_slab_free(cp, obj);
+        goto done;
+    }
+
+    /* Flush half of the magazine */
+    while (mag->count > KMEM_MAG_SIZE / 2) {
+        kmem_slab_free(cp, mag->objs[--mag->count]);
+    }
+
+    mag->objs[mag->count++] = obj;
+done:
+    spinlock_release(&cp->lock);
+    md_intr_restore(intr);
+}
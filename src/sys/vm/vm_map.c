@@ -32,14 +32,20 @@
 #include <sys/errno.h>
 #include <sys/param.h>
 #include <sys/syslog.h>
+#include <sys/proc.h>
 #include <vm/physseg.h>
 #include <vm/mmu.h>
 #include <vm/map.h>
+#include <vm/range.h>
 #include <vm/vm.h>
+#include <stdbool.h>
 
 #define MMAP_START 0x6F3C8E0C0000
 #define MMAP_END   0x6F3C90000000
 
+/* Pages released per TLB shootdown by vm_unmap() */
+#define UNMAP_BATCH 32
+
 /*
  * Create a virtual to physical memory
  * mapping
@@ -48,9 +54,7 @@ static int
 __vm_map(struct vm_vas *vas, struct mmu_map *spec, size_t len, int prot)
 {
     const size_t PSIZE = DEFAULT_PAGESIZE;
-    struct mmu_map tmp_spec;
-    vaddr_t va_cur, va_end;
-    vaddr_t va_start;
+    bool owned = false;
     int error;
 
     if (vas == NULL || spec == NULL) {
@@ -63,6 +67,9 @@ __vm_map(struct vm_vas *vas, struct mmu_map *spec, size_t len, int prot)
 
     /* Must be 4K aligned */
     len = ALIGN_UP(len, PSIZE);
+    if (prot == 0) {
+        return mmu_unmap_range(vas, spec->va, len);
+    }
 
     /*
      * If we encounter any address that is zero, we
@@ -72,86 +79,397 @@ __vm_map(struct vm_vas *vas, struct mmu_map *spec, size_t len, int prot)
         spec->pa = vm_alloc_frame(len / PSIZE);
         if (spec->va == 0)
             spec->va = spec->pa;
+
+        owned = true;
     }
 
     if (spec->pa == 0) {
         return -ENOMEM;
     }
 
-    /* Must be on a 4K boundary */
-    tmp_spec.va = ALIGN_DOWN(spec->va, PSIZE);
-    tmp_spec.pa = ALIGN_DOWN(spec->pa, PSIZE);
+    /* Nothing is left mapped if this fails */
+    error = mmu_map_range(vas, spec, len, prot);
+    if (error < 0 && owned) {
+        vm_free_frame(spec->pa, len / PSIZE);
+    }
+
+    return error;
+}
+
+int
+vm_map(struct vm_vas *vas, struct mmu_map *spec, size_t len, int prot)
+{
+    const size_t PSIZE = DEFAULT_PAGESIZE;
+    int error;
+
+    if (spec == NULL) {
+        return -EINVAL;
+    }
+
+    len = ALIGN_UP(len, PSIZE);
+    error = __vm_map(vas, spec, len, prot);
+    if (error < 0) {
+        printf("vm_map: could not map <%p>\n", spec->va);
+        return error;
+    }
+
+    /* Place a guard page at the end */
+    mmu_unmap_range(vas, spec->va + len, PSIZE);
+    return 0;
+}
+
+/*
+ * Split a range in two at a page aligned address
+ * within it, the upper half is returned. Only the
+ * upper half can still grow as a stack.
+ *
+ * XXX: The caller must hold `maplist_lock'
+ */
+static struct vm_range *
+vm_range_split(struct proc *procp, struct vm_range *range, vaddr_t va)
+{
+    struct vm_range *upper;
+    size_t off = va - range->va_base;
+
+    if ((upper = vm_range_alloc()) == NULL) {
+        return NULL;
+    }
+
+    upper->va_base = va;
+    upper->len = range->len - off;
+    upper->prot = range->prot;
+    upper->flags = range->flags;
+    upper->pa_base = range->pa_base;
+    if (!ISSET(range->flags, VM_RANGE_LAZY)) {
+        upper->pa_base += off;
+    }
+
+    range->len = off;
+    range->flags &= ~VM_RANGE_STACK;
+    vm_range_fixup(range);
+    if (vm_range_insert(&procp->maplist, upper) < 0) {
+        range->len += upper->len;
+        range->flags = upper->flags;
+        vm_range_fixup(range);
+        vm_range_free(upper);
+        return NULL;
+    }
+
+    return upper;
+}
+
+/*
+ * Unmap part of a range and drop whatever memory
+ * backs it there.
+ *
+ * @vas: Address space the range lives in
+ * @range: Range to release pages of
+ * @va: Page aligned base to release
+ * @len: Length to release (4K aligned)
+ */
+static void
+vm_range_release(struct vm_vas *vas, struct vm_range *range, vaddr_t va,
+    size_t len)
+{
+    const size_t PSIZE = DEFAULT_PAGESIZE;
+    paddr_t batch[UNMAP_BATCH];
+    vaddr_t end = va + len;
+    size_t n;
+
+    if (!ISSET(range->flags, VM_RANGE_LAZY)) {
+        mmu_unmap_range(vas, va, len);
+        if (ISSET(range->flags, VM_RANGE_OWNED)) {
+            vm_free_frame(range->pa_base + (va - range->va_base), len / PSIZE);
+        }
+        return;
+    }
 
     /*
-     * start: always the mapping base
-     * cur: current pointer sliding around
-     * end: region end
+     * A frame may only be dropped once nothing can reach it
+     * through the TLB anymore, so unmap them in batches.
      */
-    va_start = spec->va;
-    va_cur = spec->va;
-    va_end = spec->va + len;
+    while (va < end) {
+        n = MIN((end - va) / PSIZE, UNMAP_BATCH);
+        for (size_t i = 0; i < n; ++i) {
+            if (mmu_translate(vas, va + i * PSIZE, &batch[i]) < 0)
+                batch[i] = 0;
+        }
 
-    while (va_cur < va_end) {
-        error = mmu_map_single(vas, &tmp_spec, prot);
-        if (error < 0) {
-            return spec->va;
+        mmu_unmap_range(vas, va, n * PSIZE);
+        for (size_t i = 0; i < n; ++i) {
+            if (batch[i] != 0)
+                vm_frame_unref(batch[i]);
         }
 
-        va_cur += PSIZE;
-        tmp_spec.va += PSIZE;
-        tmp_spec.pa += PSIZE;
+        va += n * PSIZE;
     }
-
-    return 0;
 }
 
 int
-vm_map(struct vm_vas *vas, struct mmu_map *spec, size_t len, int prot)
+vm_reserve(struct proc *procp, vaddr_t va, size_t len, int prot, int flags)
 {
     const size_t PSIZE = DEFAULT_PAGESIZE;
-    int retval;
-    size_t unmap_len;
-    struct mmu_map spec_cpy;
-    struct proc *self = proc_self();
+    vaddr_t end;
+    int error;
 
-    if (spec != NULL) {
-        spec_cpy = *spec;
+    if (procp == NULL || len == 0) {
+        return -EINVAL;
     }
 
-    /* If this fails, unmap the partial region */
+    va = ALIGN_DOWN(va, PSIZE);
     len = ALIGN_UP(len, PSIZE);
-    retval = __vm_map(vas, spec, len, prot);
-    if (retval != 0) {
-        printf("vm_map: could not map <%p>\n", spec_cpy.va);
-        unmap_len = retval - spec_cpy.va;
+    end = va + len;
+    if (end <= va) {
+        return -EINVAL;
+    }
 
-        __vm_map(vas, &spec_cpy, unmap_len, 0);
-        return -1;
+    /* The tree refuses anything that overlaps */
+    spinlock_acquire(&procp->maplist_lock);
+    error = proc_add_range(procp, va, 0, len, prot, flags | VM_RANGE_LAZY);
+    spinlock_release(&procp->maplist_lock);
+    return error;
+}
+
+int
+vm_unmap(struct proc *procp, vaddr_t va, size_t len)
+{
+    const size_t PSIZE = DEFAULT_PAGESIZE;
+    struct vm_range *range;
+    vaddr_t end;
+    int error = 0;
+
+    if (procp == NULL || len == 0) {
+        return -EINVAL;
     }
 
-    /* Add the range if we can */
-    if (self != NULL) {
-        spinlock_acquire(&self->maplist_lock);
-        proc_add_range(self, spec->va, spec->pa, len);
-        spinlock_release(&self->maplist_lock);
+    va = ALIGN_DOWN(va, PSIZE);
+    end = va + ALIGN_UP(len, PSIZE);
+    if (end <= va) {
+        return -EINVAL;
     }
 
-    /* Place a guard page at the end */
-    spec_cpy.va = spec_cpy.va + len;
-    __vm_map(vas, &spec_cpy, DEFAULT_PAGESIZE, 0);
-    return 0;
+    spinlock_acquire(&procp->maplist_lock);
+    while ((range = vm_range_lookup(&procp->maplist, va)) != NULL) {
+        if (range->va_base >= end) {
+            break;
+        }
+
+        /* Cut off whatever is outside of the hole */
+        if (range->va_base < va) {
+            range = vm_range_split(procp, range, va);
+        }
+        if (range != NULL && (range->va_base + range->len) > end) {
+            if (vm_range_split(procp, range, end) == NULL)
+                range = NULL;
+        }
+
+        if (range == NULL) {
+            error = -ENOMEM;
+            break;
+        }
+
+        vm_range_release(&procp->pcb.vas, range, range->va_base, range->len);
+        proc_del_range(procp, range);
+    }
+
+    spinlock_release(&procp->maplist_lock);
+    return error;
+}
+
+int
+vm_protect(struct proc *procp, vaddr_t va, size_t len, int prot)
+{
+    const size_t PSIZE = DEFAULT_PAGESIZE;
+    struct vm_range *range;
+    vaddr_t end, addr;
+    int error = 0, pte_prot;
+
+    if (procp == NULL || len == 0) {
+        return -EINVAL;
+    }
+
+    /*
+     * A page without PROT_READ is not present as far as
+     * the MMU is concerned, we'd lose track of its frame.
+     */
+    if (!ISSET(prot, PROT_READ)) {
+        return -ENOTSUP;
+    }
+
+    va = ALIGN_DOWN(va, PSIZE);
+    end = va + ALIGN_UP(len, PSIZE);
+    if (end <= va) {
+        return -EINVAL;
+    }
+
+    spinlock_acquire(&procp->maplist_lock);
+
+    /* Check everything first so we never half apply it */
+    for (addr = va; addr < end; addr = range->va_base + range->len) {
+        if ((range = vm_range_find(&procp->maplist, addr)) == NULL) {
+            error = -ENOMEM;
+            goto done;
+        }
+
+        /* Memory we don't own (e.g., initrd pages) stays read-only */
+        if (!ISSET(range->flags, VM_RANGE_LAZY | VM_RANGE_OWNED) &&
+            !ISSET(range->prot, PROT_WRITE) && ISSET(prot, PROT_WRITE)) {
+            error = -EACCES;
+            goto done;
+        }
+    }
+
+    for (addr = va; addr < end; addr = range->va_base + range->len) {
+        range = vm_range_find(&procp->maplist, addr);
+        if (range->va_base < addr) {
+            range = vm_range_split(procp, range, addr);
+        }
+        if (range != NULL && (range->va_base + range->len) > end) {
+            if (vm_range_split(procp, range, end) == NULL)
+                range = NULL;
+        }
+
+        if (range == NULL) {
+            error = -ENOMEM;
+            break;
+        }
+
+        /*
+         * Pages of lazy ranges may be shared copy-on-write,
+         * writes fault and take private pages back cheaply.
+         */
+        pte_prot = prot;
+        if (ISSET(range->flags, VM_RANGE_LAZY)) {
+            pte_prot &= ~PROT_WRITE;
+        }
+
+        range->prot = prot;
+        mmu_protect_range(&procp->pcb.vas, range->va_base, range->len, pte_prot);
+    }
+
+done:
+    spinlock_release(&procp->maplist_lock);
+    return error;
+}
+
+int
+vm_fork(struct proc *parent, struct proc *child)
+{
+    const size_t PSIZE = DEFAULT_PAGESIZE;
+    struct vm_vas *pvas, *cvas;
+    struct vm_range *range;
+    struct mmu_map spec;
+    vaddr_t end;
+    int error = 0, prot_ro;
+
+    if (parent == NULL || child == NULL) {
+        return -EINVAL;
+    }
+
+    pvas = &parent->pcb.vas;
+    cvas = &child->pcb.vas;
+
+    spinlock_acquire(&parent->maplist_lock);
+    RB_FOREACH(range, vm_range_tree, &parent->maplist) {
+        /*
+         * From here on each frame in the range is owned by
+         * whoever holds a reference to it, both sides see
+         * the pages read-only until they write to them.
+         */
+        if (ISSET(range->flags, VM_RANGE_OWNED | VM_RANGE_LAZY)) {
+            range->flags &= ~VM_RANGE_OWNED;
+            range->flags |= VM_RANGE_LAZY;
+        }
+
+        /* Track it first so a failure cleans up after us */
+        spinlock_acquire(&child->maplist_lock);
+        error = proc_add_range(
+            child, range->va_base,
+            range->pa_base, range->len,
+            range->prot, range->flags
+        );
+        spinlock_release(&child->maplist_lock);
+        if (error < 0) {
+            break;
+        }
+
+        /* Memory that isn't ours (e.g., MMIO) is just shared */
+        if (!ISSET(range->flags, VM_RANGE_LAZY)) {
+            spec.va = range->va_base;
+            spec.pa = range->pa_base;
+            error = mmu_map_range(cvas, &spec, range->len, range->prot);
+            if (error < 0)
+                break;
+
+            continue;
+        }
+
+        prot_ro = range->prot & ~PROT_WRITE;
+        end = range->va_base + range->len;
+        for (spec.va = range->va_base; spec.va < end; spec.va += PSIZE) {
+            if (mmu_translate(pvas, spec.va, &spec.pa) < 0)
+                continue;
+
+            if ((error = mmu_map_single(cvas, &spec, prot_ro)) < 0)
+                break;
+
+            vm_frame_ref(spec.pa);
+        }
+
+        if (error < 0) {
+            break;
+        }
+
+        if (ISSET(range->prot, PROT_WRITE)) {
+            mmu_protect_range(pvas, range->va_base, range->len, prot_ro);
+        }
+    }
+
+    spinlock_release(&parent->maplist_lock);
+    return error;
+}
+
+/*
+ * Reserve memory anywhere in the mmap window of
+ * a process.
+ */
+static vaddr_t
+vm_reserve_any(struct proc *procp, size_t len, int prot)
+{
+    vaddr_t va;
+    int error;
+
+    len = ALIGN_UP(len, DEFAULT_PAGESIZE);
+    spinlock_acquire(&procp->maplist_lock);
+    va = vm_range_fit(
+        &procp->maplist, len,
+        MMAP_START, MMAP_END,
+        procp->mmap_hint
+    );
+
+    if (va == 0) {
+        spinlock_release(&procp->maplist_lock);
+        return 0;
+    }
+
+    error = proc_add_range(procp, va, 0, len, prot, VM_RANGE_LAZY);
+    if (error == 0) {
+        procp->mmap_hint = va + len;
+    }
+
+    spinlock_release(&procp->maplist_lock);
+    return (error == 0) ? va : 0;
 }
 
 void *
 mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
 {
     struct mmu_map spec;
-    struct vm_vas vas;
-    paddr_t pa;
+    struct vm_vas vas, *vasp = &vas;
+    struct proc *self;
     int error;
 
-    /* TODO: Support address allocation  */
-    if (len == 0 || addr == NULL) {
+    if (len == 0) {
         return NULL;
     }
 
@@ -162,8 +480,36 @@ mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
         return NULL;
     }
 
+    /* Use the real VAS of the process if we can */
+    if ((self = proc_self()) != NULL) {
+        vasp = &self->pcb.vas;
+    }
+
+    /*
+     * Only reserve the range for users, frames are
+     * allocated as the pages are touched. We pick the
+     * address if they don't care where it goes.
+     */
+    if (self != NULL && ISSET(prot, PROT_USER)) {
+        if (spec.va == 0) {
+            return (void *)vm_reserve_any(self, len, prot);
+        }
+
+        error = vm_reserve(self, spec.va, len, prot, 0);
+        if (error < 0) {
+            return NULL;
+        }
+
+        return (void *)spec.va;
+    }
+
+    /* The kernel must say where it wants it */
+    if (addr == NULL) {
+        return NULL;
+    }
+
     /* Create the mapping */
-    error = vm_map(&vas, &spec, len, prot);
+    error = vm_map(vasp, &spec, len, prot);
     if (error < 0) {
         return NULL;
     }
@@ -171,6 +517,30 @@ mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
     return (void *)spec.va;
 }
 
+int
+munmap(void *addr, size_t len)
+{
+    struct proc *self;
+
+    if ((self = proc_self()) == NULL) {
+        return -ESRCH;
+    }
+
+    return vm_unmap(self, (vaddr_t)addr, len);
+}
+
+int
+mprotect(void *addr, size_t len, int prot)
+{
+    struct proc *self;
+
+    if ((self = proc_self()) == NULL) {
+        return -ESRCH;
+    }
+
+    return vm_protect(self, (vaddr_t)addr, len, prot);
+}
+
 /*
  * ARG0: Address
  * ARG1: Length
@@ -194,3 +564,32 @@ sys_mmap(struct syscall_args *scargs)
     /* XXX: Should use rest of the args */
     return (uintptr_t)mmap(address, length, prot, 0, 0, 0);
 }
+
+/*
+ * ARG0: Address
+ * ARG1: Length
+ */
+scret_t
+sys_munmap(struct syscall_args *scargs)
+{
+    void *address = SCARG(scargs, void *, 0);
+    size_t length = SCARG(scargs, size_t, 1);
+
+    return munmap(address, length);
+}
+
+/*
+ * ARG0: Address
+ * ARG1: Length
+ * ARG2: Protection flags
+ */
+scret_t
+sys_mprotect(struct syscall_args *scargs)
+{
+    void *address = SCARG(scargs, void *, 0);
+    size_t length = SCARG(scargs, size_t, 1);
+    int prot = SCARG(scargs, int, 2);
+
+    prot &= (PROT_READ | PROT_WRITE | PROT_EXEC);
+    return mprotect(address, length, prot | PROT_USER);
+}
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and L5 engineers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Description: Per-process range tree and address allocator
+ * Author: Ian Marco Moffett
+ */
+
+/*
+ * Each node tracks the holes within its own subtree so
+ * that free space can be found without walking every
+ * range, this must be set up before the tree macros.
+ */
+#define RB_AUGMENT(x) vm_range_augment(x)
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/errno.h>
+#include <sys/tree.h>
+#include <vm/kmem.h>
+#include <vm/range.h>
+#include <vm/vm.h>
+#include <string.h>
+
+#define RANGE_END(RANGE) ((RANGE)->va_base + (RANGE)->len)
+
+static struct kmem_cache range_cache = KMEM_CACHE_INIT(
+    "vm_range",
+    sizeof(struct vm_range),
+    NULL
+);
+
+/*
+ * Recompute the subtree summary of a single node from
+ * its children.
+ */
+static inline void
+vm_range_augment(struct vm_range *range)
+{
+    struct vm_range *left, *right;
+    size_t gap = 0;
+
+    left = RB_LEFT(range, tree);
+    right = RB_RIGHT(range, tree);
+    range->sub_start = range->va_base;
+    range->sub_end = RANGE_END(range);
+
+    if (left != NULL) {
+        range->sub_start = left->sub_start;
+        gap = MAX(left->sub_gap, range->va_base - left->sub_end);
+    }
+
+    if (right != NULL) {
+        range->sub_end = right->sub_end;
+        gap = MAX(gap, right->sub_gap);
+        gap = MAX(gap, right->sub_start - RANGE_END(range));
+    }
+
+    range->sub_gap = gap;
+}
+
+int
+vm_range_cmp(struct vm_range *a, struct vm_range *b)
+{
+    if (a->va_base < b->va_base)
+        return -1;
+    if (a->va_base > b->va_base)
+        return 1;
+
+    return 0;
+}
+
+RB_GENERATE(vm_range_tree, vm_range, tree, vm_range_cmp)
+
+/*
+ * First fit search of a single subtree
+ *
+ * @range: Subtree root
+ * @prev_end: End of the range before this subtree
+ * @next_start: Base of the range after this subtree
+ * @len: Length needed
+ * @lo: Lowest usable address
+ * @hi: End of the usable window
+ */
+static vaddr_t
+vm_range_fit_sub(struct vm_range *range, vaddr_t prev_end, vaddr_t next_start,
+    size_t len, vaddr_t lo, vaddr_t hi)
+{
+    vaddr_t va, end;
+
+    if (range == NULL) {
+        va = MAX(prev_end, lo);
+        end = MIN(next_start, hi);
+        return (va < end && (end - va) >= len) ? va : 0;
+    }
+
+    /* Don't bother if no hole in here is big enough */
+    if (range->sub_gap < len &&
+        (range->sub_start - prev_end) < len &&
+        (next_start - range->sub_end) < len) {
+        return 0;
+    }
+
+    /* Holes on the left end at our base */
+    if (range->va_base >= lo + len) {
+        va = vm_range_fit_sub(
+            RB_LEFT(range, tree),
+            prev_end, range->va_base,
+            len, lo, hi
+        );
+
+        if (va != 0) {
+            return va;
+        }
+    }
+
+    if (RANGE_END(range) >= hi) {
+        return 0;
+    }
+
+    return vm_range_fit_sub(
+        RB_RIGHT(range, tree),
+        RANGE_END(range), next_start,
+        len, lo, hi
+    );
+}
+
+struct vm_range *
+vm_range_alloc(void)
+{
+    struct vm_range *range;
+
+    range = kmem_cache_alloc(&range_cache);
+    if (range != NULL) {
+        memset(range, 0, sizeof(*range));
+    }
+
+    return range;
+}
+
+void
+vm_range_free(struct vm_range *range)
+{
+    if (range == NULL) {
+        return;
+    }
+
+    kmem_cache_free(&range_cache, range);
+}
+
+int
+vm_range_insert(struct vm_range_tree *tree, struct vm_range *range)
+{
+    struct vm_range *next;
+
+    if (tree == NULL || range == NULL || range->len == 0) {
+        return -EINVAL;
+    }
+
+    /* Ranges may never overlap */
+    next = vm_range_lookup(tree, range->va_base);
+    if (next != NULL && next->va_base < RANGE_END(range)) {
+        return -EEXIST;
+    }
+
+    if (RB_INSERT(vm_range_tree, tree, range) != NULL) {
+        return -EEXIST;
+    }
+
+    /* The tree only fixes up the direct parent */
+    vm_range_fixup(range);
+    return 0;
+}
+
+void
+vm_range_remove(struct vm_range_tree *tree, struct vm_range *range)
+{
+    struct vm_range *parent;
+
+    if (tree == NULL || range == NULL) {
+        return;
+    }
+
+    parent = RB_PARENT(range, tree);
+    RB_REMOVE(vm_range_tree, tree, range);
+    if (parent != NULL) {
+        vm_range_fixup(parent);
+    }
+}
+
+struct vm_range *
+vm_range_lookup(struct vm_range_tree *tree, vaddr_t va)
+{
+    struct vm_range *range, *res = NULL;
+
+    if (tree == NULL) {
+        return NULL;
+    }
+
+    range = RB_ROOT(tree);
+    while (range != NULL) {
+        if (va < RANGE_END(range)) {
+            res = range;
+            if (va >= range->va_base)
+                break;
+
+            range = RB_LEFT(range, tree);
+        } else {
+            range = RB_RIGHT(range, tree);
+        }
+    }
+
+    return res;
+}
+
+struct vm_range *
+vm_range_find(struct vm_range_tree *tree, vaddr_t va)
+{
+    struct vm_range *range;
+
+    range = vm_range_lookup(tree, va);
+    if (range == NULL || va < range->va_base) {
+        return NULL;
+    }
+
+    return range;
+}
+
+void
+vm_range_fixup(struct vm_range *range)
+{
+    while (range != NULL) {
+        vm_range_augment(range);
+        range = RB_PARENT(range, tree);
+    }
+}
+
+vaddr_t
+vm_range_fit(struct vm_range_tree *tree, size_t len, vaddr_t lo,
+    vaddr_t hi, vaddr_t hint)
+{
+    vaddr_t va = 0;
+
+    if (tree == NULL || len == 0 || lo >= hi) {
+        return 0;
+    }
+
+    /* Next fit, then wrap around */
+    if (hint > lo && hint < hi) {
+        va = vm_range_fit_sub(RB_ROOT(tree), 0, (vaddr_t)-1, len, hint, hi);
+    }
+    if (va == 0) {
+        va = vm_range_fit_sub(RB_ROOT(tree), 0, (vaddr_t)-1, len, lo, hi);
+    }
+
+    return va;
+}
@@ -30,7 +30,12 @@
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sys/syslog.h>
+#include <sys/errno.h>
 #include <sys/panic.h>
+#include <sys/queue.h>
+#include <sys/cdefs.h>
+#include <sys/atomic.h>
+#include <sys/cpuvar.h>
 #include <os/spinlock.h>
 #include <vm/physseg.h>
 #include <vm/vm.h>
@@ -46,15 +51,81 @@
 
 #define BYTES_PER_MIB 8388608
 
+/*
+ * The largest block the buddy allocator manages is
+ * 2^BUDDY_MAX_ORDER frames (1 GiB with 4K frames)
+ */
+#define BUDDY_MAX_ORDER 18
+#define BUDDY_NORDER    (BUDDY_MAX_ORDER + 1)
+
+/* Max number of frames in the pre-zeroed pool */
+#define ZERO_POOL_SIZE 512
+
+/* Frame is not the head of a free block */
+#define ORDER_NONE 0xFF
+
+/* Max number of ranges that may be reclaimed late */
+#define RECLAIM_MAX 64
+
+/*
+ * A free block, this header lives within the first
+ * frame of the block itself.
+ *
+ * @link: Free list link
+ */
+struct buddy_blk {
+    LIST_ENTRY(buddy_blk) link;
+};
+
 static size_t pages_free = 0;
 static size_t pages_used = 0;
 static size_t pages_total = 0;
 static size_t highest_frame_idx = 0;
-static size_t bitmap_size = 0;
-static size_t bitmap_free_start = 0;
-static ssize_t last_idx = 0;
+static size_t order_tab_size = 0;
+
+/*
+ * Each entry in the order table describes a single
+ * frame. If the frame is the head of a free block,
+ * its entry holds the order of that block, otherwise
+ * it is ORDER_NONE.
+ */
+static uint8_t *order_tab;
+static LIST_HEAD(, buddy_blk) free_lists[BUDDY_NORDER];
+
+/*
+ * Each entry in the reference table holds the number
+ * of extra references to a frame that is mapped in
+ * more than one place, zero means a single owner.
+ */
+static volatile uint32_t *ref_tab;
+static size_t ref_tab_size = 0;
+static size_t nfree[BUDDY_NORDER];
+
+/*
+ * Frames that were zeroed ahead of time by idle
+ * cores, this is protected by its own lock so the
+ * idle cores stay off of the pool lock.
+ */
+static uintptr_t zero_pool[ZERO_POOL_SIZE];
+static size_t zero_count = 0;
+static struct spinlock zero_lock = {0};
+
+/*
+ * Ranges of memory that are in use by the bootloader
+ * or hold ACPI tables, these are handed back to us
+ * once we are done with them.
+ *
+ * @base: Base address of range
+ * @len: Length of range in bytes
+ */
+struct reclaim_range {
+    uintptr_t base;
+    size_t len;
+};
+
+static struct reclaim_range reclaim_tab[RECLAIM_MAX];
+static size_t nreclaim = 0;
 
-static uint8_t *bitmap;
 static struct limine_memmap_response *resp = NULL;
 static struct spinlock lock = {0};
 
@@ -75,44 +146,211 @@ static const char *memstr_tab[] = {
 };
 
 /*
- * Populate physical memory bitmap.
+ * Get the block header of a specific frame
+ *
+ * @idx: Frame index
+ */
+static inline struct buddy_blk *
+buddy_blk_get(size_t idx)
+{
+    return PHYS_TO_VIRT(idx * DEFAULT_PAGESIZE);
+}
+
+/*
+ * Put a block on its free list
+ *
+ * @idx: Frame index of the block head
+ * @order: Order of the block
+ */
+static inline void
+buddy_push(size_t idx, uint8_t order)
+{
+    struct buddy_blk *blk = buddy_blk_get(idx);
+
+    LIST_INSERT_HEAD(&free_lists[order], blk, link);
+    order_tab[idx] = order;
+    ++nfree[order];
+}
+
+/*
+ * Take a specific block off of its free list
+ *
+ * @idx: Frame index of the block head
+ */
+static inline void
+buddy_unlink(size_t idx)
+{
+    struct buddy_blk *blk = buddy_blk_get(idx);
+    uint8_t order = order_tab[idx];
+
+    LIST_REMOVE(blk, link);
+    order_tab[idx] = ORDER_NONE;
+    --nfree[order];
+}
+
+/*
+ * Return a block back to the free lists, merging it
+ * with its buddy for as long as the buddy is free as
+ * well.
+ *
+ * @idx: Frame index of the block head
+ * @order: Order of the block
+ */
+static void
+buddy_free_block(size_t idx, uint8_t order)
+{
+    size_t buddy;
+
+    if (__unlikely(order_tab[idx] != ORDER_NONE)) {
+        printf("vm_seg: double free of frame %p\n", idx * DEFAULT_PAGESIZE);
+        return;
+    }
+
+    while (order < BUDDY_MAX_ORDER) {
+        buddy = idx ^ BIT(order);
+        if (buddy > highest_frame_idx) {
+            break;
+        }
+
+        /* Only merge if the buddy is a free block of our size */
+        if (order_tab[buddy] != order) {
+            break;
+        }
+
+        buddy_unlink(buddy);
+        idx = MIN(idx, buddy);
+        ++order;
+    }
+
+    buddy_push(idx, order);
+}
+
+/*
+ * Free a range of frames by splitting it into the
+ * largest naturally aligned blocks that fit.
+ *
+ * @idx: Frame index to start at
+ * @count: Number of frames in the range
+ */
+static void
+buddy_free_range(size_t idx, size_t count)
+{
+    uint8_t order;
+    size_t align_order, size_order;
+
+    while (count > 0) {
+        align_order = (idx == 0) ? BUDDY_MAX_ORDER : __builtin_ctzl(idx);
+        size_order = 63 - __builtin_clzl(count);
+
+        order = MIN(align_order, size_order);
+        order = MIN(order, BUDDY_MAX_ORDER);
+        buddy_free_block(idx, order);
+
+        idx += BIT(order);
+        count -= BIT(order);
+    }
+}
+
+/*
+ * Check if a memory map entry may be reclaimed
+ * at some point.
+ *
+ * @ent: Memory map entry
+ */
+static inline bool
+physmem_is_reclaimable(struct limine_memmap_entry *ent)
+{
+    switch (ent->type) {
+    case LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE:
+    case LIMINE_MEMMAP_ACPI_RECLAIMABLE:
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Remember a range of memory to be reclaimed later,
+ * the memory map itself is within such a range.
+ *
+ * @ent: Memory map entry
  */
 static void
-physmem_populate_bitmap(void)
+physmem_note_reclaim(struct limine_memmap_entry *ent)
+{
+    struct reclaim_range *rp;
+
+    /* Merge with the last one if we can */
+    if (nreclaim > 0) {
+        rp = &reclaim_tab[nreclaim - 1];
+        if (rp->base + rp->len == ent->base) {
+            rp->len += ent->length;
+            return;
+        }
+    }
+
+    if (nreclaim >= RECLAIM_MAX) {
+        printf("vm_seg: not reclaiming [%p -> %p]\n",
+            ent->base, ent->base + ent->length);
+        return;
+    }
+
+    rp = &reclaim_tab[nreclaim++];
+    rp->base = ent->base;
+    rp->len = ent->length;
+}
+
+/*
+ * Populate the buddy free lists using usable
+ * entries from the memory map.
+ */
+static void
+physmem_populate_buddy(void)
 {
     struct limine_memmap_entry *ent;
+    size_t idx, count;
 
     for (size_t i = 0; i < resp->entry_count; ++i) {
         ent = resp->entries[i];
         pages_total += ent->length / DEFAULT_PAGESIZE;
 
         if (ent->type != LIMINE_MEMMAP_USABLE) {
-            /* This memory is not usable */
+            /* This memory is not usable (yet) */
+            if (physmem_is_reclaimable(ent))
+                physmem_note_reclaim(ent);
+
             pages_used += ent->length / DEFAULT_PAGESIZE;
             continue;
         }
 
-        if (bitmap_free_start == 0) {
-            bitmap_free_start = ent->base / DEFAULT_PAGESIZE;
-        }
-
-        for (size_t j = 0; j < ent->length; j += DEFAULT_PAGESIZE) {
-            clrbit(bitmap, (ent->base + j) / DEFAULT_PAGESIZE);
+        idx = ent->base / DEFAULT_PAGESIZE;
+        count = ent->length / DEFAULT_PAGESIZE;
+
+        /*
+         * A physical address of zero is used to indicate
+         * allocation failure, never hand it out.
+         */
+        if (idx == 0 && count > 0) {
+            ++idx;
+            --count;
+            ++pages_used;
         }
 
-        pages_free += ent->length / DEFAULT_PAGESIZE;
+        buddy_free_range(idx, count);
+        pages_free += count;
     }
 }
 
 /*
- * Allocate physical memory for the bitmap
- * we'll use to keep track of free memory.
+ * Allocate physical memory for the order table
+ * we'll use to keep track of free blocks, and the
+ * frame reference table right after it.
  */
 static void
-physmem_alloc_bitmap(void)
+physmem_alloc_order_tab(void)
 {
     struct limine_memmap_entry *ent;
-    uintptr_t highest_addr = 0;
+    size_t total = order_tab_size + ref_tab_size;
 
     for (size_t i = 0; i < resp->entry_count; ++i) {
         ent = resp->entries[i];
@@ -122,23 +360,26 @@ physmem_alloc_bitmap(void)
             continue;
         }
 
-        if (ent->length >= bitmap_size) {
-            bitmap = PHYS_TO_VIRT(ent->base);
-            memset(bitmap, 0xFF, bitmap_size);
-            ent->length -= bitmap_size;
-            ent->base += bitmap_size;
+        if (ent->length >= total) {
+            order_tab = PHYS_TO_VIRT(ent->base);
+            memset(order_tab, ORDER_NONE, order_tab_size);
+            ref_tab = PTR_OFFSET(order_tab, order_tab_size);
+            memset((void *)ref_tab, 0, ref_tab_size);
+            ent->length -= total;
+            ent->base += total;
             return;
         }
-
-        highest_addr = MAX(highest_addr, ent->base + ent->length);
     }
+
+    panic("vm_seg: could not allocate order table\n");
 }
 
 /*
- * Init the physical memory bitmap.
+ * Init the buddy allocator using the memory map
+ * handed to us by the bootloader.
  */
 static void
-physmem_init_bitmap(void)
+physmem_init_buddy(void)
 {
     uintptr_t highest_addr = 0;
     struct limine_memmap_entry *ent;
@@ -161,108 +402,603 @@ physmem_init_bitmap(void)
         }
 
         if (ent->type != LIMINE_MEMMAP_USABLE) {
-            continue;
+            if (!physmem_is_reclaimable(ent))
+                continue;
         }
 
         highest_addr = MAX(highest_addr, ent->base + ent->length);
     }
 
+    for (int i = 0; i < BUDDY_NORDER; ++i) {
+        LIST_INIT(&free_lists[i]);
+    }
+
     highest_frame_idx = highest_addr / DEFAULT_PAGESIZE;
-    bitmap_size = ALIGN_UP(highest_frame_idx / 8, DEFAULT_PAGESIZE);
+    order_tab_size = ALIGN_UP(highest_frame_idx + 1, DEFAULT_PAGESIZE);
+    ref_tab_size = (highest_frame_idx + 1) * sizeof(*ref_tab);
+    ref_tab_size = ALIGN_UP(ref_tab_size, DEFAULT_PAGESIZE);
 
-    physmem_alloc_bitmap();
-    physmem_populate_bitmap();
+    physmem_alloc_order_tab();
+    physmem_populate_buddy();
 }
 
 /*
  * Allocate page frames.
  *
  * @count: Number of frames to allocate.
+ *
+ * XXX: Power of two counts are naturally aligned
+ *      to their size.
  */
 static uintptr_t
 __vm_alloc_frame(size_t count)
 {
-    size_t frames = 0;
-    ssize_t idx = -1;
-    uintptr_t ret = 0;
+    uint8_t order, cur;
+    size_t idx;
+
+    /* Round up to the next power of two */
+    order = (count <= 1) ? 0 : 64 - __builtin_clzl(count - 1);
+    if (order > BUDDY_MAX_ORDER) {
+        return 0;
+    }
 
-    for (size_t i = last_idx; i < highest_frame_idx; ++i) {
-        if (!testbit(bitmap, i)) {
-            if (idx < 0)
-                idx = i;
-            if (++frames >= count)
-                break;
+    /* Find the smallest block that fits */
+    for (cur = order; cur < BUDDY_NORDER; ++cur) {
+        if (!LIST_EMPTY(&free_lists[cur]))
+            break;
+    }
 
-            continue;
+    if (cur >= BUDDY_NORDER) {
+        return 0;
+    }
+
+    idx = VIRT_TO_PHYS(LIST_FIRST(&free_lists[cur])) / DEFAULT_PAGESIZE;
+    buddy_unlink(idx);
+
+    /* Split it down, giving the upper halves back */
+    while (cur > order) {
+        --cur;
+        buddy_push(idx + BIT(cur), cur);
+    }
+
+    /* Return the tail we do not need */
+    if (count < BIT(order)) {
+        buddy_free_range(idx + count, BIT(order) - count);
+    }
+
+    return idx * DEFAULT_PAGESIZE;
+}
+
+/*
+ * Allocate frames straight from the global pool
+ *
+ * @count: Number of frames to allocate
+ *
+ * XXX: Interrupts must be masked
+ *
+ * Returns zero on failure
+ */
+static uintptr_t
+pool_alloc(size_t count)
+{
+    uintptr_t pa;
+
+    spinlock_acquire(&lock);
+    if ((pa = __vm_alloc_frame(count)) != 0) {
+        pages_used += count;
+        pages_free -= count;
+    }
+    spinlock_release(&lock);
+    return pa;
+}
+
+/*
+ * Free frames straight to the global pool
+ *
+ * @idx: Frame index to start at
+ * @count: Number of frames to free
+ *
+ * XXX: Interrupts must be masked
+ */
+static void
+pool_free(size_t idx, size_t count)
+{
+    spinlock_acquire(&lock);
+    buddy_free_range(idx, count);
+    pages_used -= count;
+    pages_free += count;
+    spinlock_release(&lock);
+}
+
+/*
+ * Allocate a single frame from a per-core cache,
+ * refilling it from the global pool if it is empty.
+ *
+ * @pc: Per-core cache to allocate from
+ *
+ * XXX: Interrupts must be masked
+ */
+static uintptr_t
+pcache_alloc(struct vm_pcache *pc)
+{
+    uintptr_t pa = 0;
+    size_t n;
+
+    spinlock_acquire(&pc->lock);
+    if (pc->count > 0) {
+        ++pc->hits;
+        pa = pc->frames[--pc->count];
+        spinlock_release(&pc->lock);
+        return pa;
+    }
+
+    ++pc->misses;
+    spinlock_acquire(&lock);
+    for (n = 0; n < PCACHE_BATCH; ++n) {
+        if ((pa = __vm_alloc_frame(1)) == 0)
+            break;
+
+        pc->frames[pc->count++] = pa;
+    }
+
+    pages_used += n;
+    pages_free -= n;
+    spinlock_release(&lock);
+
+    pa = 0;
+    if (pc->count > 0) {
+        pa = pc->frames[--pc->count];
+    }
+
+    spinlock_release(&pc->lock);
+    return pa;
+}
+
+/*
+ * Return a single frame to a per-core cache, draining
+ * the oldest half back into the global pool if it is
+ * full.
+ *
+ * @pc: Per-core cache to free to
+ * @pa: Frame to free
+ *
+ * XXX: Interrupts must be masked
+ */
+static void
+pcache_free(struct vm_pcache *pc, uintptr_t pa)
+{
+    spinlock_acquire(&pc->lock);
+    if (pc->count >= PCACHE_SIZE) {
+        spinlock_acquire(&lock);
+        for (size_t i = 0; i < PCACHE_BATCH; ++i) {
+            buddy_free_range(pc->frames[i] / DEFAULT_PAGESIZE, 1);
         }
 
-        idx = -1;
-        frames = 0;
+        pages_used -= PCACHE_BATCH;
+        pages_free += PCACHE_BATCH;
+        spinlock_release(&lock);
+
+        pc->count -= PCACHE_BATCH;
+        memcpy(
+            pc->frames,
+            &pc->frames[PCACHE_BATCH],
+            pc->count * sizeof(pc->frames[0])
+        );
     }
 
-    if (idx < 0 || frames != count) {
-        ret = 0;
-        goto done;
+    pc->frames[pc->count++] = pa;
+    spinlock_release(&pc->lock);
+}
+
+/*
+ * Give every frame in a per-core cache back to the
+ * global pool, this may be done from any core.
+ *
+ * @pc: Per-core cache to drain
+ *
+ * XXX: Interrupts must be masked
+ */
+static void
+pcache_drain(struct vm_pcache *pc)
+{
+    spinlock_acquire(&pc->lock);
+    spinlock_acquire(&lock);
+    for (size_t i = 0; i < pc->count; ++i) {
+        buddy_free_range(pc->frames[i] / DEFAULT_PAGESIZE, 1);
     }
 
-    for (size_t i = idx; i < idx + count; ++i) {
-        setbit(bitmap, i);
+    pages_used -= pc->count;
+    pages_free += pc->count;
+    pc->count = 0;
+    spinlock_release(&lock);
+    spinlock_release(&pc->lock);
+}
+
+/*
+ * Take a frame from the pre-zeroed pool
+ *
+ * Returns zero if the pool is empty
+ *
+ * XXX: Interrupts must be masked
+ */
+static uintptr_t
+zero_pool_take(void)
+{
+    uintptr_t pa = 0;
+
+    /* Don't bother locking if it is empty */
+    if (zero_count == 0) {
+        return 0;
+    }
+
+    spinlock_acquire(&zero_lock);
+    if (zero_count > 0) {
+        pa = zero_pool[--zero_count];
+    }
+    spinlock_release(&zero_lock);
+    return pa;
+}
+
+/*
+ * Give every frame in the pre-zeroed pool back to
+ * the global pool.
+ *
+ * XXX: Interrupts must be masked
+ */
+static void
+zero_pool_drain(void)
+{
+    spinlock_acquire(&zero_lock);
+    spinlock_acquire(&lock);
+    for (size_t i = 0; i < zero_count; ++i) {
+        buddy_free_range(zero_pool[i] / DEFAULT_PAGESIZE, 1);
+    }
+
+    pages_used -= zero_count;
+    pages_free += zero_count;
+    zero_count = 0;
+    spinlock_release(&lock);
+    spinlock_release(&zero_lock);
+}
+
+/*
+ * Put frames that sit idle in the pre-zeroed pool and
+ * in the caches of every core back into the global
+ * pool, so they may be handed out and coalesce with
+ * their buddies again.
+ *
+ * XXX: Interrupts must be masked
+ */
+static void
+vm_drain_cached(void)
+{
+    struct pcore *core;
+    size_t ncores;
+
+    zero_pool_drain();
+    ncores = cpu_count();
+    for (size_t i = 0; i < ncores; ++i) {
+        if ((core = cpu_get(i)) != NULL)
+            pcache_drain(&core->pcache);
     }
-    ret = idx * DEFAULT_PAGESIZE;
-    last_idx = idx;
-    memset(PHYS_TO_VIRT(ret), 0, count * DEFAULT_PAGESIZE);
-done:
-    return ret;
 }
 
 /*
  * Central frame allocation routine
  */
 uintptr_t
-vm_alloc_frame(size_t count)
+vm_alloc_frame_flags(size_t count, int flags)
 {
+    struct pcore *core;
     uintptr_t ret;
+    uint64_t intr;
 
-    spinlock_acquire(&lock);
-    if ((ret = __vm_alloc_frame(count)) == 0) {
-        last_idx = 0;
-        ret = __vm_alloc_frame(count);
+    if (count == 0) {
+        return 0;
     }
 
+    /*
+     * Single frames come from our core's cache if we can,
+     * interrupts stay masked so we cannot be preempted by
+     * something that wants the cache or the pool lock.
+     */
+    intr = md_intr_save();
+    core = this_core();
+
+    /* Try to grab a frame that is already zeroed */
+    if (count == 1 && !ISSET(flags, VM_ALLOC_NOZERO)) {
+        if ((ret = zero_pool_take()) != 0) {
+            md_intr_restore(intr);
+            return ret;
+        }
+    }
+
+    if (count == 1 && core != NULL) {
+        ret = pcache_alloc(&core->pcache);
+    } else {
+        ret = pool_alloc(count);
+    }
+
+    /*
+     * We may only be out of memory because it is cached
+     * elsewhere, get it back and give it another shot.
+     */
+    if (ret == 0) {
+        vm_drain_cached();
+        ret = pool_alloc(count);
+    }
+
+    md_intr_restore(intr);
     if (ret == 0) {
+        if (ISSET(flags, VM_ALLOC_TRY))
+            return 0;
+
         panic("out of memory\n");
     }
 
-    pages_used += count;
-    pages_free -= count;
-    spinlock_release(&lock);
+    if (!ISSET(flags, VM_ALLOC_NOZERO)) {
+        memset(PHYS_TO_VIRT(ret), 0, count * DEFAULT_PAGESIZE);
+    }
+
     return ret;
 }
 
+uintptr_t
+vm_alloc_frame(size_t count)
+{
+    return vm_alloc_frame_flags(count, 0);
+}
+
 /*
  * Central frame freeing routine
  */
 void
 vm_free_frame(uintptr_t base, size_t count)
 {
-    size_t stop_at = base + (count * DEFAULT_PAGESIZE);
+    struct pcore *core;
+    uint64_t intr;
+    size_t idx;
+
+    base = ALIGN_DOWN(base, DEFAULT_PAGESIZE);
+    idx = base / DEFAULT_PAGESIZE;
+
+    if (count == 0 || idx == 0) {
+        return;
+    }
+
+    if ((idx + count - 1) > highest_frame_idx) {
+        printf("vm_free_frame: bad range %p (%d frames)\n", base, count);
+        return;
+    }
+
+    /* Single frames go back to our core's cache */
+    intr = md_intr_save();
+    core = this_core();
+    if (count == 1 && core != NULL) {
+        pcache_free(&core->pcache, base);
+    } else {
+        pool_free(idx, count);
+    }
+
+    md_intr_restore(intr);
+}
+
+/*
+ * Take another reference to a frame
+ */
+void
+vm_frame_ref(uintptr_t pa)
+{
+    size_t idx = pa / DEFAULT_PAGESIZE;
+
+    if (idx == 0 || idx > highest_frame_idx) {
+        return;
+    }
+
+    atomic_inc_int(&ref_tab[idx]);
+}
+
+/*
+ * Drop a reference to a frame
+ */
+void
+vm_frame_unref(uintptr_t pa)
+{
+    size_t idx = pa / DEFAULT_PAGESIZE;
+
+    if (idx == 0 || idx > highest_frame_idx) {
+        return;
+    }
+
+    /*
+     * Only the last holder sees the count wrap, two
+     * holders dropping at once both see a valid count.
+     */
+    if (atomic_dec_int(&ref_tab[idx]) != (uint32_t)-1) {
+        return;
+    }
+
+    ref_tab[idx] = 0;
+    vm_free_frame(ALIGN_DOWN(pa, DEFAULT_PAGESIZE), 1);
+}
+
+/*
+ * Check if a frame is shared
+ */
+bool
+vm_frame_shared(uintptr_t pa)
+{
+    size_t idx = pa / DEFAULT_PAGESIZE;
+
+    if (idx == 0 || idx > highest_frame_idx) {
+        return false;
+    }
+
+    return atomic_load_int(&ref_tab[idx]) != 0;
+}
+
+/*
+ * Get the number of free blocks of a specific
+ * order.
+ */
+size_t
+vm_seg_nfree(uint8_t order)
+{
+    if (order >= BUDDY_NORDER) {
+        return 0;
+    }
+
+    return nfree[order];
+}
+
+/*
+ * Zero a single frame for the pre-zeroed pool
+ */
+int
+vm_zero_idle(void)
+{
+    uintptr_t pa;
+    uint64_t intr;
+
+    if (zero_count >= ZERO_POOL_SIZE) {
+        return -1;
+    }
+
+    /*
+     * Take the frame from the global pool rather than our
+     * cache, and don't eat into memory that is running low.
+     */
+    pa = 0;
+    intr = md_intr_save();
+    spinlock_acquire(&lock);
+    if (pages_free >= ZERO_POOL_SIZE * 2) {
+        if ((pa = __vm_alloc_frame(1)) != 0) {
+            ++pages_used;
+            --pages_free;
+        }
+    }
+    spinlock_release(&lock);
+    md_intr_restore(intr);
+
+    if (pa == 0) {
+        return -1;
+    }
+
+    /* Zero it without any locks held */
+    memset(PHYS_TO_VIRT(pa), 0, DEFAULT_PAGESIZE);
+
+    intr = md_intr_save();
+    spinlock_acquire(&zero_lock);
+    if (zero_count < ZERO_POOL_SIZE) {
+        zero_pool[zero_count++] = pa;
+        pa = 0;
+    }
+    spinlock_release(&zero_lock);
+
+    /* Someone else filled the pool before us */
+    if (pa != 0) {
+        pool_free(pa / DEFAULT_PAGESIZE, 1);
+    }
+
+    md_intr_restore(intr);
+    return (pa != 0) ? -1 : 0;
+}
+
+/*
+ * Free a range of frames that was reclaimed
+ *
+ * @base: Base address of range
+ * @end: End address of range
+ *
+ * XXX: Pool lock must be held
+ *
+ * Returns the number of frames freed
+ */
+static size_t
+physmem_reclaim_range(uintptr_t base, uintptr_t end)
+{
+    size_t idx, count;
 
     base = ALIGN_UP(base, DEFAULT_PAGESIZE);
+    end = ALIGN_DOWN(end, DEFAULT_PAGESIZE);
+    if (base >= end) {
+        return 0;
+    }
+
+    idx = base / DEFAULT_PAGESIZE;
+    count = (end - base) / DEFAULT_PAGESIZE;
+
+    /* Never hand out frame zero */
+    if (idx == 0) {
+        ++idx;
+        if (--count == 0)
+            return 0;
+    }
 
+    buddy_free_range(idx, count);
+    return count;
+}
+
+int
+vm_seg_reclaim(struct physmem_stat *stat, uintptr_t *keep, size_t nkeep)
+{
+    struct reclaim_range *rp;
+    uintptr_t cur, end, tmp;
+    size_t n = 0, k = 0, j;
+    uint64_t intr;
+
+    if (stat == NULL) {
+        return -EINVAL;
+    }
+
+    /* Sort the frames to keep so we can walk them in order */
+    for (size_t i = 1; i < nkeep; ++i) {
+        tmp = keep[i];
+        for (j = i; j > 0 && keep[j - 1] > tmp; --j) {
+            keep[j] = keep[j - 1];
+        }
+        keep[j] = tmp;
+    }
+
+    intr = md_intr_save();
     spinlock_acquire(&lock);
-    for (uintptr_t p = base; p < stop_at; p += DEFAULT_PAGESIZE) {
-        clrbit(bitmap, p / DEFAULT_PAGESIZE);
+    for (size_t i = 0; i < nreclaim; ++i) {
+        rp = &reclaim_tab[i];
+        cur = rp->base;
+        end = rp->base + rp->len;
+
+        /* Free everything in between the frames we keep */
+        while (k < nkeep && keep[k] < end) {
+            if (keep[k] >= cur) {
+                n += physmem_reclaim_range(cur, keep[k]);
+                cur = keep[k] + DEFAULT_PAGESIZE;
+            }
+            ++k;
+        }
+
+        n += physmem_reclaim_range(cur, end);
     }
-    pages_used -= count;
-    pages_free += count;
+
+    nreclaim = 0;
+    pages_used -= n;
+    pages_free += n;
+    stat->pages_free = pages_free;
+    stat->pages_used = pages_used;
     spinlock_release(&lock);
+    md_intr_restore(intr);
+
+    printf("vm_seg: reclaimed %d KiB\n", (n * DEFAULT_PAGESIZE) / 1024);
+    return 0;
 }
 
 int
 vm_seg_init(struct physmem_stat *stat)
 {
     resp = mmap_req.response;
-    physmem_init_bitmap();
+    physmem_init_buddy();
+
+    /* The memory map is reclaimed later on */
+    resp = NULL;
 
     stat->pages_free = pages_free;
     stat->pages_used = pages_used;
@@ -54,7 +54,15 @@
 #define OMAR_EXTRACT  1
 
 /* Revision */
-#define OMAR_REV 2
+#define OMAR_REV 3
+
+/*
+ * Starting with revision 3, regular file data begins on
+ * a page boundary (relative to the start of the archive)
+ * so that a loaded image may be mapped in place.
+ */
+#define OMAR_REV_ALIGN 3
+#define DATA_ALIGN 4096
 
 #define ALIGN_UP(value, align)        (((value) + (align)-1) & ~((align)-1))
 #define BLOCK_SIZE 512
@@ -155,7 +163,8 @@ file_push(const char *pathname, const char *name)
     int infd, rem, error;
     int pad_len;
     size_t len;
-    char *buf;
+    off_t off;
+    char *buf, *pad;
 
     hdr.type = OMAR_REG;
 
@@ -225,14 +234,23 @@ file_push(const char *pathname, const char *name)
         return -EIO;
     }
 
+    /* Pad up to the data boundary */
+    off = lseek(outfd, 0, SEEK_CUR);
+    pad_len = ALIGN_UP(off, DATA_ALIGN) - off;
+    if (pad_len != 0) {
+        pad = calloc(1, pad_len);
+        write(outfd, pad, pad_len);
+        free(pad);
+    }
+
     /*
      * Write the actual file contents, if the file length is not
      * a multiple of the block size, we'll need to pad out the rest
      * to zero.
      */
     write(outfd, buf, hdr.len);
-    len = sizeof(hdr) + (hdr.namelen + hdr.len);
-    rem = len & (BLOCK_SIZE - 1);
+    off = lseek(outfd, 0, SEEK_CUR);
+    rem = off & (BLOCK_SIZE - 1);
     if (rem != 0) {
         /* Compute the padding length */
         pad_len = BLOCK_SIZE - rem;
@@ -384,9 +402,13 @@ archive_extract(void)
             off = 512;
             mkpath(hdr, pathbuf);
         } else {
-            off = ALIGN_UP(sizeof(*hdr) + hdr->namelen + hdr->len, BLOCK_SIZE);
             p = (char *)hdr + sizeof(struct omar_hdr);
             p += hdr->namelen;
+            if (hdr->rev >= OMAR_REV_ALIGN) {
+                p = buf + ALIGN_UP(p - buf, DATA_ALIGN);
+            }
+
+            off = ALIGN_UP((p - (char *)hdr) + hdr->len, BLOCK_SIZE);
             extract_single(hdr, p, hdr->len, pathbuf);
         }
 